@@ -0,0 +1,267 @@
+// Benchmarks the matvec and matmul kernels of matvec.hpp at every instruction set the CPU supports
+// against Eigen, on the shapes of the network's dense layers, and checks that they agree. A second
+// table runs the products of a dense layer through both compute backends of backends.hpp, and a
+// third one the 8 bit integer dot product of the quantized engine.
+//
+// Usage: kernel_bench [repetitions]
+
+#include "../src/backends.hpp"
+#include "../src/matvec.hpp"
+
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+template< typename Function >
+double medianSeconds(size_t repetitions, Function&& function)
+{
+    function(); // Warm-up
+
+    std::vector< double > seconds(repetitions);
+    for (auto& s : seconds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        s = std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+    }
+    std::nth_element(seconds.begin(), seconds.begin() + seconds.size() / 2, seconds.end());
+    return seconds[seconds.size() / 2];
+}
+
+template< typename T >
+std::vector< T > randomValues(size_t count, std::mt19937& gen)
+{
+    std::uniform_real_distribution< T > distribution(-1, 1);
+    std::vector< T > values(count);
+    for (auto& v : values)
+    {
+        v = distribution(gen);
+    }
+    return values;
+}
+
+template< typename T >
+void printRow(const std::string& kernel, const std::string& shape, const std::string& backend, double seconds,
+              double flops, double maxError)
+{
+    std::cout << std::setw(8) << kernel << std::setw(16) << shape << std::setw(12) << backend << std::fixed
+              << std::setprecision(2) << std::setw(12) << seconds * 1e6 << std::setw(10) << flops / seconds / 1e9
+              << std::scientific << std::setprecision(1) << std::setw(12) << maxError << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// Benchmarks out = lhs * rhs with lhs rows x inner and rhs inner x cols; cols = 1 is a matvec.
+template< typename T >
+void benchmarkShape(size_t rows, size_t inner, size_t cols, size_t repetitions, std::mt19937& gen)
+{
+    using RowMajorMatrix = Eigen::Matrix< T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor >;
+
+    std::vector< T > lhs = randomValues< T >(rows * inner, gen);
+    std::vector< T > rhs = randomValues< T >(inner * cols, gen);
+    std::vector< T > out(rows * cols), reference(rows * cols);
+
+    Eigen::Map< const RowMajorMatrix > lhsMap(lhs.data(), rows, inner);
+    Eigen::Map< const RowMajorMatrix > rhsMap(rhs.data(), inner, cols);
+    Eigen::Map< RowMajorMatrix > referenceMap(reference.data(), rows, cols);
+
+    const std::string kernel = cols == 1 ? "matvec" : "matmul";
+    const std::string shape = std::to_string(rows) + "x" + std::to_string(inner) + "x" + std::to_string(cols);
+    const double flops = 2.0 * rows * inner * cols;
+
+    double eigenSeconds = medianSeconds(repetitions, [&] { referenceMap.noalias() = lhsMap * rhsMap; });
+    printRow< T >(kernel, shape, "eigen", eigenSeconds, flops, 0.0);
+
+    const SimdLevel detected = detectSimdLevel();
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512})
+    {
+        if (level > detected)
+        {
+            continue;
+        }
+        activeSimdLevel() = level;
+
+        double seconds = medianSeconds(repetitions, [&]
+        {
+            if (cols == 1)
+            {
+                matvec(lhs.data(), rhs.data(), out.data(), rows, inner);
+            }
+            else
+            {
+                matmul(lhs.data(), rhs.data(), out.data(), rows, inner, cols);
+            }
+        });
+
+        double maxError = 0.0;
+        for (size_t i = 0; i < out.size(); i++)
+        {
+            maxError = std::max(maxError, static_cast< double >(std::abs(out[i] - reference[i])));
+        }
+        printRow< T >(kernel, shape, simdLevelName(level), seconds, flops, maxError);
+    }
+    activeSimdLevel() = detected;
+}
+
+template< typename T >
+void benchmarkType(const std::string& name, size_t repetitions, std::mt19937& gen)
+{
+    std::cout << name << ":" << std::endl;
+    std::cout << std::setw(8) << "kernel" << std::setw(16) << "shape" << std::setw(12) << "backend" << std::setw(12)
+              << "median us" << std::setw(10) << "GFLOP/s" << std::setw(12) << "max error" << std::endl;
+
+    // Dense layers of the 784-500-10 network, for single samples and a batch of 32
+    benchmarkShape< T >(500, 784, 1, repetitions, gen);
+    benchmarkShape< T >(10, 500, 1, repetitions, gen);
+    benchmarkShape< T >(500, 784, 32, repetitions, gen);
+    benchmarkShape< T >(10, 500, 32, repetitions, gen);
+    benchmarkShape< T >(784, 500, 32, repetitions, gen);
+}
+
+// Times the forward product, the two backward products and the weight update of a dense layer with
+// inputSize inputs and outputSize outputs on a batch, for the Eigen and the native backend. Errors
+// are relative to the Eigen backend.
+template< typename T >
+void benchmarkLayer(size_t inputSize, size_t outputSize, size_t batch, size_t repetitions, std::mt19937& gen)
+{
+    using Matrix = Eigen::Matrix< T, Eigen::Dynamic, Eigen::Dynamic >;
+
+    const auto in = static_cast< Eigen::Index >(inputSize);
+    const auto out = static_cast< Eigen::Index >(outputSize);
+    const auto columns = static_cast< Eigen::Index >(batch);
+
+    auto randomMatrix = [&](Eigen::Index rows, Eigen::Index cols)
+    {
+        std::vector< T > values = randomValues< T >(static_cast< size_t >(rows * cols), gen);
+        return Matrix(Eigen::Map< const Matrix >(values.data(), rows, cols));
+    };
+    Matrix weights = randomMatrix(out, in), input = randomMatrix(in, columns);
+    Matrix gradient = randomMatrix(out, columns), weightGradient = randomMatrix(out, in);
+    Matrix output[2], weightResult[2], inputResult[2];
+
+    const std::string shape = std::to_string(inputSize) + "->" + std::to_string(outputSize);
+    const double productFlops = 2.0 * inputSize * outputSize * batch;
+    const double updateFlops = 2.0 * inputSize * outputSize;
+
+    auto run = [&]< typename Backend >(size_t slot, Backend)
+    {
+        output[slot].resize(out, columns);
+        weightResult[slot].resize(out, in);
+        inputResult[slot].resize(in, columns);
+        Matrix parameters = weights;
+
+        typename EigenBackend< T >::Vector packing(Backend::packingSize(out, in, columns, true));
+
+        const std::string name = computeBackendName(Backend::kind);
+        double forward = medianSeconds(repetitions, [&] { Backend::multiply(weights, input, output[slot], packing); });
+        double weight = medianSeconds(repetitions, [&]
+        {
+            Backend::weightGradient(gradient, input, weightResult[slot], packing);
+        });
+        double inputGradient = medianSeconds(repetitions, [&]
+        {
+            Backend::inputGradient(weights, gradient, inputResult[slot], packing);
+        });
+        double update = medianSeconds(repetitions, [&]
+        {
+            Backend::update(parameters.data(), weightGradient.data(), parameters.size(), T(1e-6));
+        });
+
+        auto error = [&](const Matrix* results) { return static_cast< double >((results[slot] - results[0]).cwiseAbs().maxCoeff()); };
+        printRow< T >("forward", shape, name, forward, productFlops, error(output));
+        printRow< T >("dW", shape, name, weight, productFlops, error(weightResult));
+        printRow< T >("dX", shape, name, inputGradient, productFlops, error(inputResult));
+        printRow< T >("update", shape, name, update, updateFlops, 0.0);
+    };
+
+    run(0, EigenBackend< T >());
+    run(1, NativeBackend< T >());
+}
+
+template< typename T >
+void benchmarkLayers(const std::string& name, size_t repetitions, std::mt19937& gen)
+{
+    std::cout << name << " dense layers, batch 32:" << std::endl;
+    std::cout << std::setw(8) << "product" << std::setw(16) << "layer" << std::setw(12) << "backend" << std::setw(12)
+              << "median us" << std::setw(10) << "GFLOP/s" << std::setw(12) << "max error" << std::endl;
+
+    benchmarkLayer< T >(784, 500, 32, repetitions, gen);
+    benchmarkLayer< T >(500, 10, 32, repetitions, gen);
+}
+
+// Times rows 8 bit dot products of length inner, one quantized dense layer applied to one sample,
+// at every integer instruction set the CPU supports. Errors are relative to the scalar kernel.
+void benchmarkIntegerDot(size_t rows, size_t inner, size_t repetitions, std::mt19937& gen)
+{
+    std::uniform_int_distribution< int > activation(0, 127), weight(-127, 127);
+    std::vector< uint8_t > activations(inner);
+    std::vector< int8_t > weights(rows * inner);
+    for (auto& a : activations)
+    {
+        a = static_cast< uint8_t >(activation(gen));
+    }
+    for (auto& w : weights)
+    {
+        w = static_cast< int8_t >(weight(gen));
+    }
+
+    std::vector< int32_t > out(rows), reference(rows);
+    for (size_t row = 0; row < rows; row++)
+    {
+        reference[row] = dotU8S8Scalar(activations.data(), weights.data() + row * inner, inner);
+    }
+
+    const std::string shape = std::to_string(rows) + "x" + std::to_string(inner) + "x1";
+    const IntegerDotLevel detected = detectIntegerDotLevel();
+    for (IntegerDotLevel level : {IntegerDotLevel::Scalar, IntegerDotLevel::AVX2, IntegerDotLevel::AVXVNNI,
+                                  IntegerDotLevel::AVX512VNNI})
+    {
+        if (level > detected)
+        {
+            continue;
+        }
+        activeIntegerDotLevel() = level;
+
+        double seconds = medianSeconds(repetitions, [&]
+        {
+            for (size_t row = 0; row < rows; row++)
+            {
+                out[row] = dotU8S8(activations.data(), weights.data() + row * inner, inner);
+            }
+        });
+
+        double maxError = 0.0;
+        for (size_t row = 0; row < rows; row++)
+        {
+            maxError = std::max(maxError, std::abs(static_cast< double >(out[row]) - reference[row]));
+        }
+        printRow< int8_t >("u8s8", shape, integerDotLevelName(level), seconds, 2.0 * rows * inner, maxError);
+    }
+    activeIntegerDotLevel() = detected;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t repetitions = argc > 1 ? std::stoul(argv[1]) : 50;
+    std::mt19937 gen(42);
+
+    Eigen::setNbThreads(1);
+    std::cout << "Detected instruction set: " << simdLevelName(detectSimdLevel()) << std::endl;
+
+    benchmarkType< double >("double", repetitions, gen);
+    benchmarkType< float >("float", repetitions, gen);
+    benchmarkLayers< double >("double", repetitions, gen);
+    benchmarkLayers< float >("float", repetitions, gen);
+
+    // Rows padded to 64 bytes, as stored by the quantized engine; GFLOP/s counts integer operations
+    std::cout << "int8:" << std::endl;
+    std::cout << std::setw(8) << "kernel" << std::setw(16) << "shape" << std::setw(12) << "backend" << std::setw(12)
+              << "median us" << std::setw(10) << "GFLOP/s" << std::setw(12) << "max error" << std::endl;
+    benchmarkIntegerDot(500, 832, repetitions, gen);
+    benchmarkIntegerDot(10, 512, repetitions, gen);
+
+    return 0;
+}
@@ -0,0 +1,483 @@
+// Micro-benchmarks of the building blocks of training and inference: the dense layer, ReLU,
+// SoftMax and the losses, the matvec kernel, tensor element access, tensor file reads and IDX
+// loading. Every benchmark runs warm-up iterations and then timed repetitions, and reports the
+// median and 99th percentile time per iteration with the throughput at the median, in samples/s or
+// GB/s. All inputs come from fixed seeds, so results of different versions on the same machine are
+// comparable; --format csv or json prints one machine-readable record per benchmark.
+//
+// Usage: nn_bench [--repetitions N] [--warmup N] [--filter substring] [--format table|csv|json]
+//                 [--dir directory for the temporary files]
+
+#include "../src/data_loader/dataset.hpp"
+#include "../src/layers.hpp"
+#include "../src/loss.hpp"
+#include "../src/matvec.hpp"
+#include "../src/tensor.hpp"
+
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+constexpr uint32_t BENCH_SEED = 42;
+
+// Keeps the compiler from discarding a result that is never read.
+template< typename T >
+void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Options
+{
+    size_t repetitions = 100;
+    size_t warmup = 10;
+    std::string filter;
+    std::string format = "table";
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+};
+
+struct Result
+{
+    std::string name;
+    std::string unit;
+    double median = 0.0;
+    double p99 = 0.0;
+    double mean = 0.0;
+    double throughput = 0.0;
+};
+
+// Times benchmarks and prints their results in the requested format. Table and CSV rows are printed
+// as soon as a benchmark finishes, JSON once all of them have.
+class Harness
+{
+public:
+    explicit Harness(Options options) : options_(std::move(options))
+    {
+        if (options_.format == "table")
+        {
+            std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(12) << "median us"
+                      << std::setw(12) << "p99 us" << std::setw(16) << "throughput" << "  unit" << std::endl;
+        }
+        else if (options_.format == "csv")
+        {
+            std::cout << "name,repetitions,median_us,p99_us,mean_us,throughput,unit" << std::endl;
+        }
+    }
+
+    // Runs function as one iteration of the benchmark name, which processes items samples or bytes
+    // per iteration; unit is "samples/s" or "GB/s". Skipped unless the name contains the filter.
+    template< typename Function >
+    void run(const std::string& name, const std::string& unit, double items, Function&& function)
+    {
+        if (!options_.filter.empty() && name.find(options_.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < options_.warmup; i++)
+        {
+            function();
+        }
+
+        std::vector< double > seconds(std::max< size_t >(options_.repetitions, 1));
+        for (auto& s : seconds)
+        {
+            auto start = std::chrono::steady_clock::now();
+            function();
+            s = std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+        }
+        std::sort(seconds.begin(), seconds.end());
+
+        Result result;
+        result.name = name;
+        result.unit = unit;
+        result.median = seconds[seconds.size() / 2];
+        result.p99 = seconds[std::min(seconds.size() - 1, static_cast< size_t >(std::ceil(0.99 * seconds.size())) - 1)];
+        result.mean = std::accumulate(seconds.begin(), seconds.end(), 0.0) / static_cast< double >(seconds.size());
+        result.throughput = items / result.median / (unit == "GB/s" ? 1e9 : 1.0);
+        results_.push_back(result);
+
+        if (options_.format == "table")
+        {
+            std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << result.median * 1e6 << std::setw(12) << result.p99 * 1e6
+                      << std::setw(16) << result.throughput << "  " << unit << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+        }
+        else if (options_.format == "csv")
+        {
+            std::cout << name << "," << seconds.size() << "," << result.median * 1e6 << "," << result.p99 * 1e6 << ","
+                      << result.mean * 1e6 << "," << result.throughput << "," << unit << std::endl;
+        }
+    }
+
+    void finish() const
+    {
+        if (options_.format != "json")
+        {
+            return;
+        }
+
+        std::cout << "{\n  \"context\": {\"seed\": " << BENCH_SEED << ", \"repetitions\": " << options_.repetitions
+                  << ", \"warmup\": " << options_.warmup << ", \"simd\": \"" << simdLevelName(activeSimdLevel())
+                  << "\", \"compiler\": \"" << __VERSION__ << "\"},\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results_.size(); i++)
+        {
+            const Result& result = results_[i];
+            std::cout << (i > 0 ? "," : "") << "\n    {\"name\": \"" << result.name << "\", \"median_us\": "
+                      << result.median * 1e6 << ", \"p99_us\": " << result.p99 * 1e6 << ", \"mean_us\": "
+                      << result.mean * 1e6 << ", \"throughput\": " << result.throughput << ", \"unit\": \""
+                      << result.unit << "\"}";
+        }
+        std::cout << "\n  ]\n}" << std::endl;
+    }
+
+    [[nodiscard]] const Options& options() const { return options_; }
+
+private:
+    Options options_;
+    std::vector< Result > results_;
+};
+
+template< typename T >
+MatrixX< T > randomMatrix(Eigen::Index rows, Eigen::Index cols, std::mt19937& gen)
+{
+    std::uniform_real_distribution< T > distribution(-1, 1);
+    return MatrixX< T >::NullaryExpr(rows, cols, [&] { return distribution(gen); });
+}
+
+// One-hot targets of batch random classes.
+template< typename T >
+MatrixX< T > randomTargets(Eigen::Index classes, Eigen::Index batch, std::mt19937& gen)
+{
+    std::uniform_int_distribution< Eigen::Index > distribution(0, classes - 1);
+    MatrixX< T > targets = MatrixX< T >::Zero(classes, batch);
+    for (Eigen::Index column = 0; column < batch; column++)
+    {
+        targets(distribution(gen), column) = T(1);
+    }
+    return targets;
+}
+
+// Binds the buffers of a layer state for batches of up to batch samples.
+template< typename T >
+void prepareState(const BaseLayer< T >& layer, LayerState< T >& state, Arena& arena, Eigen::Index inputRows,
+                  Eigen::Index batch, bool needsInputGradient)
+{
+    arena.beginSizing();
+    layer.prepare(state, arena, inputRows, batch, true, needsInputGradient);
+    arena.commit();
+    layer.prepare(state, arena, inputRows, batch, true, needsInputGradient);
+}
+
+// Forward and backward pass of one layer on a batch of random inputs and output gradients.
+template< typename T >
+void benchmarkLayer(Harness& harness, const std::string& name, const BaseLayer< T >& layer, Eigen::Index inputRows,
+                    Eigen::Index batch, bool needsInputGradient, std::mt19937& gen)
+{
+    Arena arena;
+    LayerState< T > state;
+    prepareState(layer, state, arena, inputRows, batch, needsInputGradient);
+
+    const MatrixX< T > input = randomMatrix< T >(inputRows, batch, gen);
+    const MatrixX< T > gradient = randomMatrix< T >(layer.outputRows(inputRows), batch, gen);
+    auto output = state.output.leftCols(batch);
+    auto inputGradient = state.inputGradient.leftCols(needsInputGradient ? batch : 0);
+    const std::string prefix = name + "/b" + std::to_string(batch);
+
+    harness.run(prefix + "/forward", "samples/s", static_cast< double >(batch), [&]
+    {
+        layer.forward(input, output, state);
+        keep(output.data()[0]);
+    });
+    harness.run(prefix + "/backward", "samples/s", static_cast< double >(batch), [&]
+    {
+        layer.backward(input, output, gradient, inputGradient, state);
+        keep(state.output.data()[0]);
+    });
+}
+
+template< typename T >
+void benchmarkLayers(Harness& harness, const std::string& type, std::mt19937& gen)
+{
+    // Dense layers of the 784-500-10 network with seeded parameters. The first one needs no input
+    // gradient in training, the second one does.
+    FullyConnectedLayer< T > hidden(784, 500), output(500, 10);
+    for (FullyConnectedLayer< T >* layer : {&hidden, &output})
+    {
+        for (auto parameter : layer->parameters())
+        {
+            parameter = randomMatrix< T >(parameter.rows(), parameter.cols(), gen) * T(0.05);
+        }
+    }
+    ReLU< T > relu;
+    SoftMax< T > softmax;
+
+    for (Eigen::Index batch : {1, 32})
+    {
+        benchmarkLayer< T >(harness, type + "/fc/784x500", hidden, 784, batch, false, gen);
+        benchmarkLayer< T >(harness, type + "/fc/500x10", output, 500, batch, true, gen);
+        benchmarkLayer< T >(harness, type + "/relu/500", relu, 500, batch, true, gen);
+        benchmarkLayer< T >(harness, type + "/softmax/10", softmax, 10, batch, true, gen);
+    }
+}
+
+template< typename T >
+void benchmarkLosses(Harness& harness, const std::string& type, std::mt19937& gen)
+{
+    const Eigen::Index batch = 32;
+    const MatrixX< T > logits = randomMatrix< T >(10, batch, gen) * T(4);
+    const MatrixX< T > targets = randomTargets< T >(10, batch, gen);
+    MatrixX< T > predictions(10, batch), gradient(10, batch);
+    softmaxColumns< T >(logits, predictions);
+    const std::string suffix = "/10/b" + std::to_string(batch);
+
+    harness.run(type + "/cross_entropy" + suffix + "/forward", "samples/s", batch, [&]
+    {
+        keep(CrossEntropyLoss< T >::forward(predictions, targets));
+    });
+    harness.run(type + "/cross_entropy" + suffix + "/backward", "samples/s", batch, [&]
+    {
+        CrossEntropyLoss< T >::backward(predictions, targets, gradient);
+        keep(gradient.data()[0]);
+    });
+    harness.run(type + "/softmax_cross_entropy" + suffix + "/forward", "samples/s", batch, [&]
+    {
+        keep(SoftMaxCrossEntropyLoss< T >::forward(logits, targets));
+    });
+    harness.run(type + "/softmax_cross_entropy" + suffix + "/backward", "samples/s", batch, [&]
+    {
+        SoftMaxCrossEntropyLoss< T >::backward(logits, targets, gradient);
+        keep(gradient.data()[0]);
+    });
+}
+
+// The matvec of the first dense layer; throughput counts the matrix bytes streamed per product.
+template< typename T >
+void benchmarkMatvec(Harness& harness, const std::string& type, std::mt19937& gen)
+{
+    const size_t rows = 500, cols = 784;
+    const MatrixX< T > matrix = randomMatrix< T >(rows * cols, 1, gen);
+    const MatrixX< T > vector = randomMatrix< T >(cols, 1, gen);
+    std::vector< T > out(rows);
+
+    harness.run(type + "/matvec/500x784", "GB/s", static_cast< double >(rows * cols * sizeof(T)), [&]
+    {
+        matvec(matrix.data(), vector.data(), out.data(), rows, cols);
+        keep(out[0]);
+    });
+}
+
+// Sums a 500 x 784 tensor element by element through the index operators of the runtime-rank and
+// the fixed-rank tensor; throughput counts the element bytes read.
+void benchmarkTensorAccess(Harness& harness, std::mt19937& gen)
+{
+    const size_t rows = 500, cols = 784;
+    std::uniform_real_distribution< double > distribution(-1, 1);
+    Tensor< double > dynamic({rows, cols});
+    Tensor< double, 2 > fixed({rows, cols});
+    for (size_t i = 0; i < dynamic.numElements(); i++)
+    {
+        dynamic.data()[i] = fixed.data()[i] = distribution(gen);
+    }
+    const double bytes = static_cast< double >(rows * cols * sizeof(double));
+
+    harness.run("double/tensor_access/dynamic_rank/500x784", "GB/s", bytes, [&]
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < rows; i++)
+        {
+            for (size_t j = 0; j < cols; j++)
+            {
+                sum += dynamic(i, j);
+            }
+        }
+        keep(sum);
+    });
+    harness.run("double/tensor_access/fixed_rank/500x784", "GB/s", bytes, [&]
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < rows; i++)
+        {
+            for (size_t j = 0; j < cols; j++)
+            {
+                sum += fixed(i, j);
+            }
+        }
+        keep(sum);
+    });
+}
+
+// Reads a tensor of the first dense layer's weights in both file formats; throughput counts file bytes.
+void benchmarkTensorFiles(Harness& harness, std::mt19937& gen)
+{
+    std::normal_distribution< double > distribution(0.0, 0.05);
+    Tensor< double > weights({500, 784});
+    for (size_t i = 0; i < weights.numElements(); i++)
+    {
+        weights.data()[i] = distribution(gen);
+    }
+
+    const std::filesystem::path& directory = harness.options().directory;
+    for (TensorFileFormat format : {TensorFileFormat::Text, TensorFileFormat::Binary})
+    {
+        const bool text = format == TensorFileFormat::Text;
+        const std::string file = directory / (text ? "nn_bench_tensor.txt" : "nn_bench_tensor.bin");
+        writeTensorToFile(weights, file, format);
+
+        harness.run(std::string("double/read_tensor/") + (text ? "text" : "binary") + "/500x784", "GB/s",
+                    static_cast< double >(std::filesystem::file_size(file)), [&]
+        {
+            Tensor< double > tensor = readTensorFromFile< double >(file);
+            keep(tensor.data()[0]);
+        });
+
+        std::filesystem::remove(file);
+    }
+}
+
+void writeBigEndian(std::ofstream& file, uint32_t value)
+{
+    const char bytes[4] = {static_cast< char >(value >> 24), static_cast< char >(value >> 16),
+                           static_cast< char >(value >> 8), static_cast< char >(value)};
+    file.write(bytes, 4);
+}
+
+// Loads an IDX image and label file pair of random 28 x 28 images with the bulk loader and gathers
+// it in batches of 32 from the memory mapped dataset. Bulk loading counts the file bytes, gathering
+// the samples.
+void benchmarkIdx(Harness& harness, std::mt19937& gen)
+{
+    const uint32_t count = 10000, side = 28;
+    const std::filesystem::path& directory = harness.options().directory;
+    const std::string imageFile = directory / "nn_bench-images.idx3-ubyte";
+    const std::string labelFile = directory / "nn_bench-labels.idx1-ubyte";
+
+    std::uniform_int_distribution< int > pixel(0, 255), label(0, 9);
+    {
+        std::vector< char > pixels(static_cast< size_t >(count) * side * side), labels(count);
+        for (auto& p : pixels)
+        {
+            p = static_cast< char >(pixel(gen));
+        }
+        for (auto& l : labels)
+        {
+            l = static_cast< char >(label(gen));
+        }
+
+        std::ofstream images(imageFile, std::ios::binary);
+        for (uint32_t value : {static_cast< uint32_t >(MAGIC_NUMBER_IMAGES), count, side, side})
+        {
+            writeBigEndian(images, value);
+        }
+        images.write(pixels.data(), static_cast< std::streamsize >(pixels.size()));
+
+        std::ofstream classes(labelFile, std::ios::binary);
+        writeBigEndian(classes, MAGIC_NUMBER_LABELS);
+        writeBigEndian(classes, count);
+        classes.write(labels.data(), static_cast< std::streamsize >(labels.size()));
+    }
+
+    const double bytes = static_cast< double >(std::filesystem::file_size(imageFile) + std::filesystem::file_size(labelFile));
+    harness.run("double/idx_load/bulk/10000", "GB/s", bytes, [&]
+    {
+        IdxDataset< double > dataset = loadIdxDataset< double >(imageFile, labelFile);
+        keep(dataset.images.data()[0]);
+    });
+
+    {
+        MappedDataset< double > dataset(imageFile, labelFile);
+        const Eigen::Index batch = 32;
+        MatrixX< double > images(side * side, batch), labels(TENSOR_SIZE, batch);
+        harness.run("double/idx_load/mapped_gather/b32", "samples/s", count, [&]
+        {
+            for (size_t first = 0; first < count; first += batch)
+            {
+                const auto columns = static_cast< Eigen::Index >(std::min< size_t >(batch, count - first));
+                dataset.gather(first, static_cast< size_t >(columns), images.leftCols(columns), labels.leftCols(columns));
+            }
+            keep(images.data()[0]);
+        });
+    }
+
+    std::filesystem::remove(imageFile);
+    std::filesystem::remove(labelFile);
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << argument << std::endl;
+            return -1;
+        }
+        const std::string value = argv[++i];
+
+        if (argument == "--repetitions")
+        {
+            options.repetitions = std::stoul(value);
+        }
+        else if (argument == "--warmup")
+        {
+            options.warmup = std::stoul(value);
+        }
+        else if (argument == "--filter")
+        {
+            options.filter = value;
+        }
+        else if (argument == "--format" && (value == "table" || value == "csv" || value == "json"))
+        {
+            options.format = value;
+        }
+        else if (argument == "--dir")
+        {
+            options.directory = value;
+        }
+        else
+        {
+            std::cerr << "unknown option: " << argument << " " << value << std::endl;
+            return -1;
+        }
+    }
+
+    // Single-threaded, so results do not depend on the load of other cores
+    Eigen::setNbThreads(1);
+    Harness harness(options);
+
+    // Every group gets its own generator, so filtering does not change the inputs of the others
+    auto seeded = [](uint32_t group) { return std::mt19937(BENCH_SEED + group); };
+    std::mt19937 gen = seeded(0);
+    benchmarkLayers< double >(harness, "double", gen);
+    gen = seeded(1);
+    benchmarkLayers< float >(harness, "float", gen);
+    gen = seeded(2);
+    benchmarkLosses< double >(harness, "double", gen);
+    gen = seeded(3);
+    benchmarkLosses< float >(harness, "float", gen);
+    gen = seeded(4);
+    benchmarkMatvec< double >(harness, "double", gen);
+    gen = seeded(5);
+    benchmarkMatvec< float >(harness, "float", gen);
+    gen = seeded(6);
+    benchmarkTensorAccess(harness, gen);
+    gen = seeded(7);
+    benchmarkTensorFiles(harness, gen);
+    gen = seeded(8);
+    benchmarkIdx(harness, gen);
+
+    harness.finish();
+    return 0;
+}
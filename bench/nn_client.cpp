@@ -0,0 +1,230 @@
+// Load generator for the prediction service of the NeuralNetwork executable ("serve" config key).
+// Every connection runs on its own thread in a closed loop: it sends one image of an IDX file,
+// waits for the predicted class and sends the next one, cycling through the images. With more
+// connections than the server's micro-batch size the server runs full batches; with a single one
+// every request waits for the batch deadline. Reports the throughput and the p50 and p99 round trip
+// latency seen by the clients, and the accuracy if the matching labels are given.
+//
+// Usage: nn_client <socket path> <images.idx3-ubyte> [--connections N] [--requests N per connection]
+//                  [--labels labels.idx1-ubyte]
+
+#include "../src/data_loader/idx_dataset.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string socketPath;
+    std::string imagePath;
+    std::string labelPath;
+    size_t connections = 8;
+    size_t requests = 10000;
+};
+
+struct ConnectionResult
+{
+    std::vector< double > latencies;  // Microseconds.
+    size_t correct = 0;
+    std::string error;
+};
+
+int connectTo(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast< const sockaddr* >(&address), sizeof(address)) < 0)
+    {
+        const std::string reason = std::strerror(errno);
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        throw std::runtime_error("Could not connect to " + path + ": " + reason);
+    }
+    return fd;
+}
+
+// Sends requests images starting at image first and records the round trip of each.
+void runConnection(const Options& options, const std::vector< uint8_t >& images, size_t imageSize,
+                   const std::vector< uint8_t >& labels, size_t first, ConnectionResult& result)
+{
+    try
+    {
+        const int fd = connectTo(options.socketPath);
+        const size_t imageCount = images.size() / imageSize;
+        result.latencies.reserve(options.requests);
+
+        for (size_t i = 0; i < options.requests; i++)
+        {
+            const size_t image = (first + i) % imageCount;
+            const Clock::time_point start = Clock::now();
+
+            const uint8_t* pixels = images.data() + image * imageSize;
+            for (size_t sent = 0; sent < imageSize;)
+            {
+                const ssize_t written = ::send(fd, pixels + sent, imageSize - sent, MSG_NOSIGNAL);
+                if (written < 0 && errno != EINTR)
+                {
+                    throw std::runtime_error(std::string("send failed: ") + std::strerror(errno));
+                }
+                sent += written > 0 ? static_cast< size_t >(written) : 0;
+            }
+
+            uint8_t predicted = 0;
+            ssize_t received;
+            while ((received = ::recv(fd, &predicted, 1, 0)) < 0 && errno == EINTR)
+            {
+            }
+            if (received != 1)
+            {
+                throw std::runtime_error("Server closed the connection");
+            }
+
+            result.latencies.push_back(std::chrono::duration< double, std::micro >(Clock::now() - start).count());
+            if (!labels.empty())
+            {
+                result.correct += predicted == labels[image];
+            }
+        }
+        ::close(fd);
+    }
+    catch (const std::exception& error)
+    {
+        result.error = error.what();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: nn_client <socket path> <images.idx3-ubyte> [--connections N] [--requests N] "
+                     "[--labels labels.idx1-ubyte]"
+                  << std::endl;
+        return -1;
+    }
+
+    Options options;
+    options.socketPath = argv[1];
+    options.imagePath = argv[2];
+    for (int i = 3; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << argument << std::endl;
+            return -1;
+        }
+        const std::string value = argv[++i];
+
+        if (argument == "--connections")
+        {
+            options.connections = std::max< size_t >(std::stoul(value), 1);
+        }
+        else if (argument == "--requests")
+        {
+            options.requests = std::stoul(value);
+        }
+        else if (argument == "--labels")
+        {
+            options.labelPath = value;
+        }
+        else
+        {
+            std::cerr << "unknown option: " << argument << " " << value << std::endl;
+            return -1;
+        }
+    }
+
+    IdxHeader imageHeader, labelHeader;
+    std::vector< uint8_t > images = readIdxPayload(options.imagePath, MAGIC_NUMBER_IMAGES, imageHeader);
+    std::vector< uint8_t > labels;
+    if (!options.labelPath.empty())
+    {
+        labels = readIdxPayload(options.labelPath, MAGIC_NUMBER_LABELS, labelHeader);
+        if (labelHeader.num_items != imageHeader.num_items)
+        {
+            std::cerr << "image and label count differ" << std::endl;
+            return -1;
+        }
+    }
+    if (imageHeader.num_items == 0)
+    {
+        std::cerr << "no images in " << options.imagePath << std::endl;
+        return -1;
+    }
+
+    // Connections start at evenly spaced images, so they do not all send the same ones
+    std::vector< ConnectionResult > results(options.connections);
+    std::vector< std::thread > threads;
+    const Clock::time_point start = Clock::now();
+    for (size_t c = 0; c < options.connections; c++)
+    {
+        const size_t first = c * imageHeader.num_items / options.connections;
+        threads.emplace_back(runConnection, std::cref(options), std::cref(images), imageHeader.itemSize(),
+                             std::cref(labels), first, std::ref(results[c]));
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration< double >(Clock::now() - start).count();
+
+    std::vector< double > latencies;
+    size_t correct = 0;
+    for (const ConnectionResult& result : results)
+    {
+        if (!result.error.empty())
+        {
+            std::cerr << result.error << std::endl;
+            return -1;
+        }
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        correct += result.correct;
+    }
+    if (latencies.empty())
+    {
+        std::cerr << "no requests sent" << std::endl;
+        return -1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double fraction)
+    {
+        return latencies[std::min(latencies.size() - 1, static_cast< size_t >(fraction * static_cast< double >(latencies.size())))];
+    };
+
+    std::cout << std::fixed << std::setprecision(1) << latencies.size() << " requests over " << options.connections
+              << " connections in " << seconds << " s: " << static_cast< double >(latencies.size()) / seconds
+              << " requests/s, latency p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max "
+              << latencies.back() << " us" << std::endl;
+    if (!labels.empty())
+    {
+        std::cout << "accuracy " << std::setprecision(2)
+                  << 100.0 * static_cast< double >(correct) / static_cast< double >(latencies.size()) << " %" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Compares the legacy line-by-line tensor file I/O with the bulk text and binary paths of
+// tensor.hpp on a tensor the size of the first dense layer's weights (500 x 784 doubles).
+//
+// Usage: tensor_io_bench [directory for the temporary files]
+
+#include "../src/tensor.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <random>
+
+namespace legacy
+{
+
+// readTensorFromFile before the bulk parser: one getline and one stringstream per element.
+template< Arithmetic ComponentType >
+Tensor< ComponentType > readTensorFromFile(const std::string& filename)
+{
+    std::ifstream file(filename);
+    std::string line;
+    std::getline(file, line);
+
+    auto rank = stringToScalar< size_t >(line);
+
+    std::vector< size_t > shape(rank);
+    for (size_t i = 0; i < rank; i++)
+    {
+        std::getline(file, line);
+        shape[i] = stringToScalar< size_t >(line);
+    }
+
+    Tensor< ComponentType > tensor(shape);
+
+    std::vector< size_t > idx(shape.size(), 0);
+    size_t cnt = 0;
+    while (cnt < tensor.numElements())
+    {
+        std::getline(file, line);
+        tensor(idx) = stringToScalar< ComponentType >(line);
+
+        idx[rank - 1]++;
+        for (size_t i = rank - 1; i > 0; i--)
+        {
+            if (idx[i] >= shape[i])
+            {
+                idx[i] = 0;
+                idx[i - 1]++;
+            }
+        }
+
+        cnt++;
+    }
+
+    return tensor;
+}
+
+// writeTensorToFile before the bulk formatter: one operator<< per element.
+template< Arithmetic ComponentType >
+void writeTensorToFile(const Tensor< ComponentType >& tensor, const std::string& filename)
+{
+    std::ofstream file(filename);
+
+    file << tensor.rank() << "\n";
+    for (auto d : tensor.shape())
+    {
+        file << d << "\n";
+    }
+
+    std::vector< size_t > idx(tensor.shape().size(), 0);
+    size_t cnt = 0;
+    while (cnt < tensor.numElements())
+    {
+        file << tensor(idx) << "\n";
+
+        idx[tensor.rank() - 1]++;
+        for (size_t i = tensor.rank() - 1; i > 0; i--)
+        {
+            if (idx[i] >= tensor.shape()[i])
+            {
+                idx[i] = 0;
+                idx[i - 1]++;
+            }
+        }
+
+        cnt++;
+    }
+}
+
+} // namespace legacy
+
+template< typename Function >
+double secondsOf(Function&& function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    std::filesystem::path directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path();
+    const std::string legacyFile = directory / "tensor_io_bench_legacy.txt";
+    const std::string textFile = directory / "tensor_io_bench.txt";
+    const std::string binaryFile = directory / "tensor_io_bench.bin";
+
+    std::mt19937 gen(42);
+    std::normal_distribution< double > distribution(0.0, 0.05);
+
+    Tensor< double > weights({500, 784});
+    for (size_t i = 0; i < weights.numElements(); i++)
+    {
+        weights.data()[i] = distribution(gen);
+    }
+
+    Tensor< double > legacyRead, textRead, binaryRead;
+    double legacyWrite = secondsOf([&] { legacy::writeTensorToFile(weights, legacyFile); });
+    double textWrite = secondsOf([&] { writeTensorToFile(weights, textFile); });
+    double binaryWrite = secondsOf([&] { writeTensorToFile(weights, binaryFile, TensorFileFormat::Binary); });
+    double legacyReadSeconds = secondsOf([&] { legacyRead = legacy::readTensorFromFile< double >(legacyFile); });
+    double textReadSeconds = secondsOf([&] { textRead = readTensorFromFile< double >(textFile); });
+    double binaryReadSeconds = secondsOf([&] { binaryRead = readTensorFromFile< double >(binaryFile); });
+
+    // The text paths must agree with each other, the binary path with the original
+    const bool textIdentical = std::filesystem::file_size(legacyFile) == std::filesystem::file_size(textFile)
+                               && readFileContents(legacyFile) == readFileContents(textFile);
+    const bool consistent = textIdentical && legacyRead == textRead && binaryRead == weights;
+
+    std::cout << "Tensor file I/O, " << weights.numElements() << " doubles:" << std::endl;
+    std::cout << std::setw(10) << "path" << std::setw(12) << "write ms" << std::setw(12) << "read ms"
+              << std::setw(12) << "file MB" << std::endl;
+    auto row = [](const std::string& name, double write, double read, const std::string& file)
+    {
+        std::cout << std::setw(10) << name << std::fixed << std::setprecision(2) << std::setw(12) << write * 1e3
+                  << std::setw(12) << read * 1e3 << std::setw(12) << std::filesystem::file_size(file) / 1e6 << std::endl;
+    };
+    row("legacy", legacyWrite, legacyReadSeconds, legacyFile);
+    row("text", textWrite, textReadSeconds, textFile);
+    row("binary", binaryWrite, binaryReadSeconds, binaryFile);
+    std::cout << "Results consistent: " << (consistent ? "yes" : "no") << std::endl;
+
+    std::filesystem::remove(legacyFile);
+    std::filesystem::remove(textFile);
+    std::filesystem::remove(binaryFile);
+
+    return consistent ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+#include "allocation_counter.hpp"
+#include <cerrno>
+#include <cstring>
+
+// Counting replacements for the malloc family. The real allocator is reached through the glibc
+// entry points, so the replacements need neither dlsym nor a recursion guard.
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+static void* countAllocation(void* pointer, size_t size) {
+    if (pointer != nullptr) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return pointer;
+}
+
+void* malloc(size_t size) {
+    return countAllocation(__libc_malloc(size), size);
+}
+
+void* calloc(size_t count, size_t size) {
+    return countAllocation(__libc_calloc(count, size), count * size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    return countAllocation(__libc_realloc(pointer, size), size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return countAllocation(__libc_memalign(alignment, size), size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return countAllocation(__libc_memalign(alignment, size), size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    // Same contract as glibc: a power of two that is a multiple of sizeof(void*)
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    void* result = countAllocation(__libc_memalign(alignment, size), size);
+    if (result == nullptr) {
+        return ENOMEM;
+    }
+    *pointer = result;
+    return 0;
+}
+}
+#endif
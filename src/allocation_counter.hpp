@@ -0,0 +1,23 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Process-wide heap allocation statistics. The counters are advanced by the malloc family
+// replacements in allocation_counter.cpp, which every executable including this header links, so
+// they also see the allocations made inside Eigen, the standard library and the OpenMP runtime.
+struct AllocationStats {
+    size_t count = 0; // Number of successful allocations.
+    size_t bytes = 0; // Number of bytes requested by them.
+
+    AllocationStats operator-(const AllocationStats& other) const {
+        return {count - other.count, bytes - other.bytes};
+    }
+};
+
+inline std::atomic<size_t> allocationCount{0};
+inline std::atomic<size_t> allocatedBytes{0};
+
+// Snapshot of the counters; the difference of two snapshots is what happened in between.
+inline AllocationStats allocationStats() {
+    return {allocationCount.load(std::memory_order_relaxed), allocatedBytes.load(std::memory_order_relaxed)};
+}
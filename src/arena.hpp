@@ -0,0 +1,81 @@
+#pragma once
+#include <eigen3/Eigen/Dense>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+// Eigen view of a matrix or vector whose storage lives in an Arena.
+template<typename Scalar>
+using MatrixMap = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>, Eigen::AlignedMax>;
+template<typename Scalar>
+using VectorMap = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>, Eigen::AlignedMax>;
+
+// Single heap block that all buffers of a pass are carved from, aligned to cache lines.
+// Buffers are laid out in two passes over the same code: a sizing pass started with beginSizing()
+// only adds up the requested sizes, then commit() allocates the block once and rewinds, and the
+// second pass hands out the actual storage. The block only grows, so later layouts that fit reuse it.
+class Arena {
+private:
+    struct FreeDeleter {
+        void operator()(std::byte* block) const { std::free(block); }
+    };
+
+    std::unique_ptr<std::byte, FreeDeleter> block;
+    size_t capacity = 0;
+    size_t offset = 0;
+    bool sizing = false;
+
+public:
+    static constexpr size_t alignment = 64;
+
+    // Starts a sizing pass: reserve() only counts bytes and returns null pointers.
+    void beginSizing() {
+        sizing = true;
+        offset = 0;
+    }
+
+    // Ends the sizing pass and makes sure the block holds everything that was counted.
+    void commit() {
+        if (offset > capacity) {
+            block.reset(static_cast<std::byte*>(std::aligned_alloc(alignment, offset)));
+            if (!block) {
+                throw std::bad_alloc();
+            }
+            capacity = offset;
+        }
+        sizing = false;
+        offset = 0;
+    }
+
+    // Returns storage for count values of type T, or nullptr during a sizing pass.
+    template<typename T>
+    T* reserve(size_t count) {
+        const size_t bytes = (count * sizeof(T) + alignment - 1) / alignment * alignment;
+        T* storage = nullptr;
+        if (!sizing) {
+            if (offset + bytes > capacity) {
+                throw std::length_error("Arena exhausted");
+            }
+            storage = reinterpret_cast<T*>(block.get() + offset);
+        }
+        offset += bytes;
+        return storage;
+    }
+
+    // Points a map at rows x cols fresh values of the arena. Maps cannot be reassigned, so the map
+    // is reconstructed in place as the Eigen documentation recommends.
+    template<typename Scalar>
+    void bind(MatrixMap<Scalar>& map, Eigen::Index rows, Eigen::Index cols) {
+        new (&map) MatrixMap<Scalar>(reserve<Scalar>(static_cast<size_t>(rows * cols)), rows, cols);
+    }
+
+    template<typename Scalar>
+    void bind(VectorMap<Scalar>& map, Eigen::Index size) {
+        new (&map) VectorMap<Scalar>(reserve<Scalar>(static_cast<size_t>(size)), size);
+    }
+
+    // Size of the block in bytes.
+    [[nodiscard]] size_t bytes() const { return capacity; }
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include "matvec.hpp"
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <string>
+
+// Compute backends of the dense layer. A backend implements the three matrix products of a fully
+// connected layer and the in-place parameter update; FullyConnectedLayer takes it as a policy
+// template argument, so the choice costs no dispatch inside the layer.
+enum class ComputeBackend {
+    Eigen,
+    Native
+};
+
+inline const char* computeBackendName(ComputeBackend backend) {
+    return backend == ComputeBackend::Native ? "native" : "eigen";
+}
+
+// Parses "eigen" or "native". Returns false for anything else.
+inline bool parseComputeBackend(const std::string& name, ComputeBackend& backend) {
+    if (name == "eigen") {
+        backend = ComputeBackend::Eigen;
+    } else if (name == "native") {
+        backend = ComputeBackend::Native;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Cache blocking of Eigen's GEMM kernel for one product, with the packed panels of both operands
+// in caller-owned storage. Eigen itself places the panels on the stack up to
+// EIGEN_STACK_ALLOCATION_LIMIT (128 KB by default) and allocates them on the heap for every larger
+// product, which the panels of the dense layers of this network are.
+template<typename Scalar>
+class PackingBlocking : public Eigen::internal::level3_blocking<Scalar, Scalar> {
+private:
+    // Keeps the rhs panel behind the lhs panel on a cache line boundary.
+    static constexpr Eigen::Index alignment = 64 / sizeof(Scalar);
+
+    Eigen::Index lhsSize() const {
+        return (this->m_kc * this->m_mc + alignment - 1) / alignment * alignment;
+    }
+
+public:
+    // Same block sizes as Eigen's single-threaded product of a rows x depth and a depth x cols matrix.
+    PackingBlocking(Eigen::Index rows, Eigen::Index cols, Eigen::Index depth) {
+        this->m_mc = rows;
+        this->m_nc = cols;
+        this->m_kc = depth;
+        Eigen::internal::computeProductBlockingSizes<Scalar, Scalar, 1, Eigen::Index>(this->m_kc, this->m_mc, this->m_nc, 1);
+    }
+
+    // Number of values of the two panels.
+    Eigen::Index size() const {
+        return lhsSize() + this->m_kc * this->m_nc;
+    }
+
+    // Whether Eigen would allocate the panels on the heap.
+    bool onHeap() const {
+        const Eigen::Index largest = std::max(this->m_mc, this->m_nc) * this->m_kc;
+        return static_cast<size_t>(largest) * sizeof(Scalar) > EIGEN_STACK_ALLOCATION_LIMIT;
+    }
+
+    // Shrinks the column and then the row blocks until both panels fit into capacity values. Any
+    // block size is valid for the kernel, this only costs cache efficiency. Returns false if the
+    // panels do not fit even then.
+    bool fit(Eigen::Index capacity) {
+        while (size() > capacity && this->m_nc > 1) {
+            this->m_nc /= 2;
+        }
+        while (size() > capacity && this->m_mc > 1) {
+            this->m_mc /= 2;
+        }
+        return size() <= capacity;
+    }
+
+    void bind(Scalar* storage) {
+        this->m_blockA = storage;
+        this->m_blockB = storage + lhsSize();
+    }
+};
+
+// Backend on top of Eigen's own GEMM.
+template<typename Scalar>
+struct EigenBackend {
+    using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+    using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+    using ConstRef = Eigen::Ref<const Matrix>;
+    using MatrixRef = Eigen::Ref<Matrix>;
+    using VectorRef = Eigen::Ref<Vector>;
+
+    static constexpr ComputeBackend kind = ComputeBackend::Eigen;
+
+    // Scratch values the products of a layer with outputs x inputs weights need for batches of up
+    // to batchColumns samples, see product(). The gradient products only count for training.
+    static Eigen::Index packingSize(Eigen::Index outputs, Eigen::Index inputs, Eigen::Index batchColumns,
+                                    bool withGradients) {
+        Eigen::Index size = heapPacking(outputs, batchColumns, inputs);
+        if (withGradients) {
+            size = std::max({size, heapPacking(outputs, inputs, batchColumns), heapPacking(inputs, batchColumns, outputs)});
+        }
+        return size;
+    }
+
+    // output = weights * input
+    static void multiply(const ConstRef& weights, const ConstRef& input, MatrixRef output, VectorRef packing) {
+        product<false, false>(weights, input, output, packing);
+    }
+
+    // weightGradient = gradient * input^T
+    static void weightGradient(const ConstRef& gradient, const ConstRef& input, MatrixRef weightGradient,
+                               VectorRef packing) {
+        product<false, true>(gradient, input, weightGradient, packing);
+    }
+
+    // inputGradient = weights^T * gradient
+    static void inputGradient(const ConstRef& weights, const ConstRef& gradient, MatrixRef inputGradient,
+                              VectorRef packing) {
+        product<true, false>(weights, gradient, inputGradient, packing);
+    }
+
+    // parameters -= learningRate * gradient over count contiguous values.
+    static void update(Scalar* parameters, const Scalar* gradient, size_t count, Scalar learningRate) {
+        Eigen::Map<Vector>(parameters, static_cast<Eigen::Index>(count)).noalias()
+                -= learningRate * Eigen::Map<const Vector>(gradient, static_cast<Eigen::Index>(count));
+    }
+
+private:
+    // Packing values of a rows x depth times depth x cols product that Eigen would allocate on the
+    // heap, 0 for products whose panels fit on the stack and for matrix-vector products.
+    static Eigen::Index heapPacking(Eigen::Index rows, Eigen::Index cols, Eigen::Index depth) {
+        if (rows <= 1 || cols <= 1) {
+            return 0;
+        }
+        const PackingBlocking<Scalar> blocking(rows, cols, depth);
+        return blocking.onHeap() ? blocking.size() : 0;
+    }
+
+    template<bool Transpose>
+    static decltype(auto) operand(const ConstRef& matrix) {
+        if constexpr (Transpose) {
+            return matrix.transpose();
+        } else {
+            return (matrix);
+        }
+    }
+
+    // dst = op(lhs) * op(rhs), with op transposing where requested. Products whose panels Eigen
+    // would allocate on the heap run its GEMM kernel directly on panels in packing instead.
+    template<bool TransposeLhs, bool TransposeRhs>
+    static void product(const ConstRef& lhs, const ConstRef& rhs, MatrixRef dst, VectorRef packing) {
+        const Eigen::Index depth = TransposeLhs ? lhs.rows() : lhs.cols();
+        PackingBlocking<Scalar> blocking(dst.rows(), dst.cols(), depth);
+        if (dst.rows() <= 1 || dst.cols() <= 1 || !blocking.onHeap() || !blocking.fit(packing.size())) {
+            dst.noalias() = operand<TransposeLhs>(lhs) * operand<TransposeRhs>(rhs);
+            return;
+        }
+
+        blocking.bind(packing.data());
+        dst.setZero();
+        Eigen::internal::general_matrix_matrix_product<Eigen::Index,
+                Scalar, TransposeLhs ? Eigen::RowMajor : Eigen::ColMajor, false,
+                Scalar, TransposeRhs ? Eigen::RowMajor : Eigen::ColMajor, false, Eigen::ColMajor, 1>::run(
+                dst.rows(), dst.cols(), depth, lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(),
+                dst.data(), 1, dst.outerStride(), Scalar(1), blocking);
+    }
+};
+
+// Backend on top of the kernels of matvec.hpp. Eigen stores column-major, and a column-major
+// r x c matrix has the memory of its row-major c x r transpose, so every product is handed to the
+// row-major kernels transposed:
+//
+//   Y = W X     is  Y^T = X^T W^T      matmul
+//   dW = G X^T  is  dW^T = X G^T       matmulTransposedLhs (X read column by column)
+//
+// The input gradient dX = W^T G would be dX^T = G^T W, which in this layout only has the dot
+// product form of matmulTransposedRhs. That loses to Eigen at every shape of the network, so it
+// always takes the Eigen path. So do the other two products of layers with fewer outputs than
+// minimumKernelOutputs, and views with gaps between columns, which the kernels cannot read.
+template<typename Scalar>
+struct NativeBackend {
+    using Matrix = typename EigenBackend<Scalar>::Matrix;
+    using ConstRef = typename EigenBackend<Scalar>::ConstRef;
+    using MatrixRef = typename EigenBackend<Scalar>::MatrixRef;
+    using VectorRef = typename EigenBackend<Scalar>::VectorRef;
+
+    static constexpr ComputeBackend kind = ComputeBackend::Native;
+
+    // The row kernels vectorize along the outputs and keep a strip of four vectors of them in
+    // registers. A narrower layer, like the 10 outputs of the MNIST network, leaves them a single
+    // partly filled vector and measured slower than Eigen.
+    static constexpr Eigen::Index minimumKernelOutputs = 32;
+
+    // The kernels pack nothing; the scratch is for the products that take the Eigen path.
+    static Eigen::Index packingSize(Eigen::Index outputs, Eigen::Index inputs, Eigen::Index batchColumns,
+                                    bool withGradients) {
+        return EigenBackend<Scalar>::packingSize(outputs, inputs, batchColumns, withGradients);
+    }
+
+    static void multiply(const ConstRef& weights, const ConstRef& input, MatrixRef output, VectorRef packing) {
+        if (weights.rows() < minimumKernelOutputs || !packed(weights) || !packed(input) || !packed(output)) {
+            EigenBackend<Scalar>::multiply(weights, input, output, packing);
+            return;
+        }
+        matmul(input.data(), weights.data(), output.data(), extent(input.cols()), extent(input.rows()),
+               extent(weights.rows()));
+    }
+
+    static void weightGradient(const ConstRef& gradient, const ConstRef& input, MatrixRef weightGradient,
+                               VectorRef packing) {
+        if (gradient.rows() < minimumKernelOutputs || !packed(gradient) || !packed(input) || !packed(weightGradient)) {
+            EigenBackend<Scalar>::weightGradient(gradient, input, weightGradient, packing);
+            return;
+        }
+        matmulTransposedLhs(input.data(), gradient.data(), weightGradient.data(), extent(input.rows()),
+                            extent(input.cols()), extent(gradient.rows()));
+    }
+
+    static void inputGradient(const ConstRef& weights, const ConstRef& gradient, MatrixRef inputGradient,
+                              VectorRef packing) {
+        EigenBackend<Scalar>::inputGradient(weights, gradient, inputGradient, packing);
+    }
+
+    static void update(Scalar* parameters, const Scalar* gradient, size_t count, Scalar learningRate) {
+        axpy(-learningRate, gradient, parameters, count);
+    }
+
+private:
+    template<typename Ref>
+    static bool packed(const Ref& matrix) {
+        return matrix.outerStride() == matrix.rows() || matrix.cols() <= 1;
+    }
+
+    static size_t extent(Eigen::Index size) {
+        return static_cast<size_t>(size);
+    }
+};
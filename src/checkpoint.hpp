@@ -0,0 +1,253 @@
+#pragma once
+#include "layers.hpp"
+#include "data_loader/mapped_file.hpp"
+#include <eigen3/Eigen/Dense>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Binary checkpoint of a layer stack. All fields are little-endian, and the file is laid out as:
+//
+//   CheckpointHeader
+//   CheckpointLayer[layerCount]      layer types and their range of parameter blocks
+//   CheckpointBlock[blockCount]      shape and file offset of every parameter block
+//   parameter blocks                 raw column-major scalars, each starting on a 64 byte boundary
+//
+// Since the blocks are aligned raw arrays, a mapped checkpoint can be used in place through
+// CheckpointView::block. The checksum covers everything after the header.
+static_assert(std::endian::native == std::endian::little, "checkpoints are stored little-endian");
+
+constexpr uint32_t CHECKPOINT_MAGIC = 0x4B434E4E; // "NNCK"
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr size_t CHECKPOINT_ALIGNMENT = 64;
+
+enum class CheckpointScalar : uint32_t {
+    Float32 = 1,
+    Float64 = 2
+};
+
+struct CheckpointHeader {
+    uint32_t magic = CHECKPOINT_MAGIC;
+    uint32_t version = CHECKPOINT_VERSION;
+    uint32_t scalarType = 0;
+    uint32_t layerCount = 0;
+    uint32_t blockCount = 0;
+    uint32_t reserved = 0;
+    uint64_t checksum = 0;
+    uint64_t fileSize = 0;
+};
+
+struct CheckpointLayer {
+    uint32_t type = 0;
+    uint32_t firstBlock = 0;
+    uint32_t blockCount = 0;
+    uint32_t reserved = 0;
+};
+
+struct CheckpointBlock {
+    uint64_t rows = 0;
+    uint64_t cols = 0;
+    uint64_t offset = 0;
+};
+
+template<typename Scalar>
+constexpr CheckpointScalar checkpointScalarOf() {
+    static_assert(std::is_same_v<Scalar, float> || std::is_same_v<Scalar, double>, "unsupported scalar type");
+    return std::is_same_v<Scalar, float> ? CheckpointScalar::Float32 : CheckpointScalar::Float64;
+}
+
+// 64 bit FNV-1a over 8 byte words, falling back to single bytes for a trailing remainder.
+inline uint64_t checkpointChecksum(const uint8_t* data, size_t size) {
+    constexpr uint64_t prime = 0x100000001B3;
+    uint64_t hash = 0xCBF29CE484222325;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+}
+
+inline size_t alignCheckpointOffset(size_t offset) {
+    return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+// Serializes the layers into one buffer and writes it with a single write. Returns the file size.
+template<typename Scalar>
+size_t saveCheckpoint(const std::string& path, const std::vector<std::shared_ptr<BaseLayer<Scalar>>>& layers) {
+    CheckpointHeader header;
+    header.scalarType = static_cast<uint32_t>(checkpointScalarOf<Scalar>());
+    header.layerCount = static_cast<uint32_t>(layers.size());
+
+    std::vector<CheckpointLayer> layerRecords;
+    std::vector<CheckpointBlock> blockRecords;
+    std::vector<Eigen::Ref<const MatrixX<Scalar>>> blocks;
+    for (const auto& layer : layers) {
+        const std::shared_ptr<const BaseLayer<Scalar>> constLayer = layer;
+        std::vector<Eigen::Ref<const MatrixX<Scalar>>> layerBlocks = constLayer->parameters();
+
+        CheckpointLayer record;
+        record.type = static_cast<uint32_t>(layer->type());
+        record.firstBlock = static_cast<uint32_t>(blocks.size());
+        record.blockCount = static_cast<uint32_t>(layerBlocks.size());
+        layerRecords.push_back(record);
+
+        for (const auto& block : layerBlocks) {
+            blocks.push_back(block);
+        }
+    }
+    header.blockCount = static_cast<uint32_t>(blocks.size());
+
+    // Lay out the parameter blocks behind the tables
+    size_t offset = sizeof(CheckpointHeader) + layerRecords.size() * sizeof(CheckpointLayer)
+                    + blocks.size() * sizeof(CheckpointBlock);
+    for (const auto& block : blocks) {
+        offset = alignCheckpointOffset(offset);
+        blockRecords.push_back({static_cast<uint64_t>(block.rows()), static_cast<uint64_t>(block.cols()), offset});
+        offset += static_cast<size_t>(block.size()) * sizeof(Scalar);
+    }
+    header.fileSize = alignCheckpointOffset(offset);
+
+    std::vector<uint8_t> bytes(header.fileSize, 0);
+    size_t position = sizeof(CheckpointHeader);
+    std::memcpy(bytes.data() + position, layerRecords.data(), layerRecords.size() * sizeof(CheckpointLayer));
+    position += layerRecords.size() * sizeof(CheckpointLayer);
+    std::memcpy(bytes.data() + position, blockRecords.data(), blockRecords.size() * sizeof(CheckpointBlock));
+
+    // Refs to whole matrices and vectors are contiguous, so every block is copied in one piece
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        std::memcpy(bytes.data() + blockRecords[i].offset, blocks[i].data(), static_cast<size_t>(blocks[i].size()) * sizeof(Scalar));
+    }
+
+    header.checksum = checkpointChecksum(bytes.data() + sizeof(CheckpointHeader), bytes.size() - sizeof(CheckpointHeader));
+    std::memcpy(bytes.data(), &header, sizeof(CheckpointHeader));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("File open failed: " + path);
+    }
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!file) {
+        throw std::runtime_error("Writing checkpoint failed: " + path);
+    }
+
+    return bytes.size();
+}
+
+// Read-only view of a mapped checkpoint. The constructor validates header, tables and checksum;
+// afterwards the parameter blocks can be read in place without copying.
+class CheckpointView {
+private:
+    MappedFile file;
+    CheckpointHeader header;
+    const CheckpointLayer* layerRecords = nullptr;
+    const CheckpointBlock* blockRecords = nullptr;
+
+public:
+    explicit CheckpointView(const std::string& path) : file(path) {
+        if (file.size() < sizeof(CheckpointHeader)) {
+            throw std::runtime_error("Truncated checkpoint: " + path);
+        }
+        std::memcpy(&header, file.data(), sizeof(CheckpointHeader));
+
+        if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION) {
+            throw std::runtime_error("Not a checkpoint of a supported version: " + path);
+        }
+        if (header.scalarType != static_cast<uint32_t>(CheckpointScalar::Float32)
+            && header.scalarType != static_cast<uint32_t>(CheckpointScalar::Float64)) {
+            throw std::runtime_error("Unknown scalar type in checkpoint: " + path);
+        }
+        if (header.fileSize != file.size()) {
+            throw std::runtime_error("Truncated checkpoint: " + path);
+        }
+
+        const size_t tablesEnd = sizeof(CheckpointHeader) + header.layerCount * sizeof(CheckpointLayer)
+                                 + header.blockCount * sizeof(CheckpointBlock);
+        if (tablesEnd > file.size()) {
+            throw std::runtime_error("Truncated checkpoint: " + path);
+        }
+
+        if (checkpointChecksum(file.data() + sizeof(CheckpointHeader), file.size() - sizeof(CheckpointHeader)) != header.checksum) {
+            throw std::runtime_error("Checkpoint checksum mismatch: " + path);
+        }
+
+        // The mapping is page aligned and the tables start at 8 byte multiples
+        layerRecords = reinterpret_cast<const CheckpointLayer*>(file.data() + sizeof(CheckpointHeader));
+        blockRecords = reinterpret_cast<const CheckpointBlock*>(layerRecords + header.layerCount);
+
+        const size_t scalarSize = header.scalarType == static_cast<uint32_t>(CheckpointScalar::Float32) ? sizeof(float) : sizeof(double);
+        for (uint32_t i = 0; i < header.layerCount; ++i) {
+            if (layerRecords[i].firstBlock + layerRecords[i].blockCount > header.blockCount) {
+                throw std::runtime_error("Corrupt checkpoint layer table: " + path);
+            }
+        }
+        for (uint32_t i = 0; i < header.blockCount; ++i) {
+            const CheckpointBlock& block = blockRecords[i];
+            if (block.offset % CHECKPOINT_ALIGNMENT != 0 || block.offset + block.rows * block.cols * scalarSize > file.size()) {
+                throw std::runtime_error("Corrupt checkpoint block table: " + path);
+            }
+        }
+    }
+
+    [[nodiscard]] CheckpointScalar scalarType() const { return static_cast<CheckpointScalar>(header.scalarType); }
+    [[nodiscard]] size_t layerCount() const { return header.layerCount; }
+    [[nodiscard]] size_t size() const { return file.size(); }
+
+    [[nodiscard]] const CheckpointLayer& layer(size_t index) const { return layerRecords[index]; }
+
+    // Parameter block as a matrix on top of the mapping. T must match scalarType().
+    template<typename T>
+    [[nodiscard]] Eigen::Map<const MatrixX<T>, Eigen::Aligned16> block(size_t index) const {
+        if (checkpointScalarOf<T>() != scalarType()) {
+            throw std::runtime_error("Checkpoint scalar type mismatch");
+        }
+        const CheckpointBlock& record = blockRecords[index];
+        return {reinterpret_cast<const T*>(file.data() + record.offset), static_cast<Eigen::Index>(record.rows),
+                static_cast<Eigen::Index>(record.cols)};
+    }
+};
+
+// Copies the parameters of a checkpoint into layers of the same types and shapes. Parameters stored
+// with the other scalar type are converted.
+template<typename Scalar>
+void loadCheckpoint(const std::string& path, const std::vector<std::shared_ptr<BaseLayer<Scalar>>>& layers) {
+    CheckpointView checkpoint(path);
+    if (checkpoint.layerCount() != layers.size()) {
+        throw std::runtime_error("Checkpoint layer count does not match the network: " + path);
+    }
+
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const CheckpointLayer& record = checkpoint.layer(i);
+        std::vector<Eigen::Ref<MatrixX<Scalar>>> parameters = layers[i]->parameters();
+        if (record.type != static_cast<uint32_t>(layers[i]->type()) || record.blockCount != parameters.size()) {
+            throw std::runtime_error("Checkpoint layer " + std::to_string(i) + " does not match the network: " + path);
+        }
+
+        for (size_t j = 0; j < parameters.size(); ++j) {
+            const size_t index = record.firstBlock + j;
+            auto copyBlock = [&](const auto& block) {
+                if (block.rows() != parameters[j].rows() || block.cols() != parameters[j].cols()) {
+                    throw std::runtime_error("Checkpoint block shape does not match the network: " + path);
+                }
+                parameters[j] = block.template cast<Scalar>();
+            };
+
+            if (checkpoint.scalarType() == CheckpointScalar::Float32) {
+                copyBlock(checkpoint.block<float>(index));
+            } else {
+                copyBlock(checkpoint.block<double>(index));
+            }
+        }
+    }
+}
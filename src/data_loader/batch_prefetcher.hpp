@@ -0,0 +1,157 @@
+#pragma once
+#include "dataset.hpp"
+#include "../profiler.hpp"
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Produces the training batches of a number of epochs on a background thread. Every epoch visits
+// the samples in a fresh random permutation (or in dataset order without shuffling), and every
+// batch is gathered into the contiguous matrices of one of two slots, so the trainer works on one
+// batch while the next one is being gathered.
+//
+// The slots form a single-producer single-consumer ring without locks: produced and consumed count
+// the batches handed over so far, each written by one side only, and batch n lives in slot
+// n % slot_count. A side that has to wait sleeps on the other side's counter with atomic wait.
+// All buffers are sized up front, so neither thread allocates once the prefetcher runs.
+template<typename T>
+class BatchPrefetcher {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+    struct Batch {
+        Matrix images, labels;  // Batch capacity columns, of which the first columns are valid.
+        Eigen::Index columns = 0;
+    };
+
+private:
+    static constexpr size_t slot_count = 2;
+
+    std::shared_ptr<const Dataset<T>> dataset;
+    size_t batch_size;
+    size_t epochs;
+    bool shuffle;
+    std::mt19937_64 generator;
+    std::vector<size_t> order;
+    std::array<Batch, slot_count> slots;
+
+    alignas(64) std::atomic<size_t> produced{0};
+    alignas(64) std::atomic<size_t> consumed{0};
+    std::atomic<bool> stopping{false};
+
+    // Time the consumer spent waiting for batches, owned by the consumer.
+    double stall_seconds = 0.0;
+
+    std::thread producer;
+
+public:
+    BatchPrefetcher(std::shared_ptr<const Dataset<T>> data, size_t batchSize, size_t epochCount, bool shuffleSamples,
+                    uint64_t seed)
+            : dataset(std::move(data)), batch_size(std::max<size_t>(batchSize, 1)), epochs(epochCount),
+              shuffle(shuffleSamples), generator(seed), order(shuffleSamples ? dataset->size() : 0) {
+        std::iota(order.begin(), order.end(), size_t(0));
+
+        const auto features = static_cast<Eigen::Index>(dataset->featureSize());
+        for (Batch& batch : slots) {
+            batch.images.resize(features, static_cast<Eigen::Index>(batch_size));
+            batch.labels.resize(TENSOR_SIZE, static_cast<Eigen::Index>(batch_size));
+        }
+
+        producer = std::thread([this] { produce(); });
+    }
+
+    BatchPrefetcher(const BatchPrefetcher&) = delete;
+    BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+    // Stops the producer, also in the middle of an epoch.
+    ~BatchPrefetcher() {
+        stopping.store(true);
+        // Moving consumed past any value the producer may be waiting on wakes it up for good
+        consumed.fetch_add(slot_count);
+        consumed.notify_all();
+        producer.join();
+    }
+
+    // Number of batches per epoch.
+    [[nodiscard]] size_t batchesPerEpoch() const {
+        return (dataset->size() + batch_size - 1) / batch_size;
+    }
+
+    // Returns the next batch, waiting for the producer if it is not ready yet. The batch stays valid
+    // until release().
+    const Batch& acquire() {
+        const size_t index = consumed.load(std::memory_order_relaxed);
+        size_t available = produced.load(std::memory_order_acquire);
+        if (available == index) {
+            NN_PROFILE_SCOPE("wait for prefetched batch");
+            auto start = std::chrono::steady_clock::now();
+            do {
+                produced.wait(available, std::memory_order_acquire);
+                available = produced.load(std::memory_order_acquire);
+            } while (available == index);
+            stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        return slots[index % slot_count];
+    }
+
+    // Hands the slot of the acquired batch back to the producer.
+    void release() {
+        consumed.fetch_add(1, std::memory_order_release);
+        consumed.notify_one();
+    }
+
+    // Returns the time acquire() spent waiting since the last call.
+    double takeStallSeconds() {
+        return std::exchange(stall_seconds, 0.0);
+    }
+
+private:
+    void produce() {
+        NN_PROFILE_THREAD("batch prefetcher");
+        const size_t sample_count = dataset->size();
+        size_t index = 0;
+
+        for (size_t epoch = 0; epoch < epochs; ++epoch) {
+            if (shuffle) {
+                std::shuffle(order.begin(), order.end(), generator);
+            }
+
+            for (size_t first = 0; first < sample_count; first += batch_size, ++index) {
+                // Wait for a free slot
+                size_t released = consumed.load(std::memory_order_acquire);
+                while (index - released == slot_count) {
+                    consumed.wait(released, std::memory_order_acquire);
+                    released = consumed.load(std::memory_order_acquire);
+                }
+                if (stopping.load()) {
+                    return;
+                }
+
+                NN_PROFILE_SCOPE("prefetch gather");
+                Batch& batch = slots[index % slot_count];
+                batch.columns = static_cast<Eigen::Index>(std::min(batch_size, sample_count - first));
+                if (shuffle) {
+                    dataset->gather(std::span<const size_t>(order).subspan(first, static_cast<size_t>(batch.columns)),
+                                    batch.images.leftCols(batch.columns), batch.labels.leftCols(batch.columns));
+                } else {
+                    // In dataset order the batch is a contiguous range, which the datasets copy in bulk
+                    dataset->gather(first, static_cast<size_t>(batch.columns), batch.images.leftCols(batch.columns),
+                                    batch.labels.leftCols(batch.columns));
+                }
+
+                produced.store(index + 1, std::memory_order_release);
+                produced.notify_one();
+            }
+        }
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include "idx_dataset.hpp"
+#include "mapped_file.hpp"
+#include <eigen3/Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+// Source of samples for the network. Samples are handed out as column batches of type T, so a
+// consumer only ever holds the floating point data of the batch it is working on.
+template<typename T>
+class Dataset {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using MatrixRef = Eigen::Ref<Matrix>;
+
+    // Number of samples in the dataset.
+    [[nodiscard]] virtual size_t size() const = 0;
+
+    // Number of features (pixels) per sample.
+    [[nodiscard]] virtual size_t featureSize() const = 0;
+
+    // Writes the samples [first, first + count) into the columns of images and their one-hot
+    // labels into the columns of labels. Both must have exactly count columns; callers typically
+    // pass the leading columns of buffers sized for the largest batch, so nothing is reallocated.
+    virtual void gather(size_t first, size_t count, MatrixRef images, MatrixRef labels) const = 0;
+
+    // Like gather, for the samples at the given indices in that order, e.g. a slice of a shuffled
+    // permutation. The batch is still written into contiguous columns.
+    virtual void gather(std::span<const size_t> indices, MatrixRef images, MatrixRef labels) const = 0;
+
+    // The featureSize() raw 8 bit pixels of sample index if the dataset keeps them, nullptr if it
+    // only holds normalized values.
+    [[nodiscard]] virtual const uint8_t* pixels(size_t) const { return nullptr; }
+
+    virtual ~Dataset() = default;
+};
+
+// Contiguous range of the samples of another dataset, used to split off a validation set.
+template<typename T>
+class DatasetSlice : public Dataset<T> {
+    using MatrixRef = typename Dataset<T>::MatrixRef;
+
+    std::shared_ptr<const Dataset<T>> source;
+    size_t offset, count;
+
+public:
+    DatasetSlice(std::shared_ptr<const Dataset<T>> dataset, size_t first, size_t size)
+            : source(std::move(dataset)), offset(first), count(size) {}
+
+    [[nodiscard]] size_t size() const override { return count; }
+    [[nodiscard]] size_t featureSize() const override { return source->featureSize(); }
+
+    void gather(size_t first, size_t count, MatrixRef images, MatrixRef labels) const override {
+        source->gather(offset + first, count, images, labels);
+    }
+
+    void gather(std::span<const size_t> indices, MatrixRef images, MatrixRef labels) const override {
+        for (size_t i = 0; i < indices.size(); ++i) {
+            const size_t index = offset + indices[i];
+            const auto column = static_cast<Eigen::Index>(i);
+            source->gather(std::span<const size_t>(&index, 1), images.col(column), labels.col(column));
+        }
+    }
+
+    [[nodiscard]] const uint8_t* pixels(size_t index) const override {
+        return source->pixels(offset + index);
+    }
+};
+
+// Dataset held fully in memory, already normalized by the bulk loader.
+template<typename T>
+class InMemoryDataset : public Dataset<T> {
+    using MatrixRef = typename Dataset<T>::MatrixRef;
+
+    IdxDataset<T> data;
+
+public:
+    explicit InMemoryDataset(IdxDataset<T> dataset) : data(std::move(dataset)) {}
+
+    [[nodiscard]] size_t size() const override { return data.size(); }
+    [[nodiscard]] size_t featureSize() const override { return static_cast<size_t>(data.images.rows()); }
+
+    void gather(size_t first, size_t count, MatrixRef images, MatrixRef labels) const override {
+        images = data.images.middleCols(static_cast<Eigen::Index>(first), static_cast<Eigen::Index>(count));
+        labels = data.labels.middleCols(static_cast<Eigen::Index>(first), static_cast<Eigen::Index>(count));
+    }
+
+    void gather(std::span<const size_t> indices, MatrixRef images, MatrixRef labels) const override {
+        for (size_t i = 0; i < indices.size(); ++i) {
+            const auto column = static_cast<Eigen::Index>(i);
+            const auto index = static_cast<Eigen::Index>(indices[i]);
+            images.col(column) = data.images.col(index);
+            labels.col(column) = data.labels.col(index);
+        }
+    }
+};
+
+// Zero-copy dataset backed by memory mapped IDX files. Pixels stay uint8 in the page cache and are
+// converted to floating point per gathered batch only.
+template<typename T>
+class MappedDataset : public Dataset<T> {
+public:
+    using MatrixRef = typename Dataset<T>::MatrixRef;
+    using ByteMatrixView = Eigen::Map<const Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic>>;
+    using ByteVectorView = Eigen::Map<const Eigen::Matrix<uint8_t, Eigen::Dynamic, 1>>;
+
+private:
+    MappedFile image_file, label_file;
+    IdxHeader image_header, label_header;
+
+public:
+    MappedDataset(const std::string& image_path, const std::string& label_path)
+            : image_file(image_path), label_file(label_path) {
+        image_header = parseIdxHeader(image_file.data(), image_file.size(), MAGIC_NUMBER_IMAGES, image_path);
+        label_header = parseIdxHeader(label_file.data(), label_file.size(), MAGIC_NUMBER_LABELS, label_path);
+
+        if (image_header.num_items != label_header.num_items) {
+            throw std::runtime_error("Image and label count differ: " + image_path + ", " + label_path);
+        }
+
+        if ((labels().array() >= static_cast<uint8_t>(TENSOR_SIZE)).any()) {
+            throw std::runtime_error("Label out of range in " + label_path);
+        }
+
+        image_file.advise(MADV_WILLNEED);
+    }
+
+    [[nodiscard]] size_t size() const override { return image_header.num_items; }
+    [[nodiscard]] size_t featureSize() const override { return image_header.itemSize(); }
+
+    // Raw pixels, one image per column, directly on top of the mapping.
+    [[nodiscard]] ByteMatrixView images() const {
+        return {image_file.data() + IMAGE_HEADER_SIZE, static_cast<Eigen::Index>(featureSize()), static_cast<Eigen::Index>(size())};
+    }
+
+    // Raw class indices on top of the mapping.
+    [[nodiscard]] ByteVectorView labels() const {
+        return {label_file.data() + LABEL_HEADER_SIZE, static_cast<Eigen::Index>(size())};
+    }
+
+    [[nodiscard]] const uint8_t* pixels(size_t index) const override {
+        return image_file.data() + IMAGE_HEADER_SIZE + index * featureSize();
+    }
+
+    // Number of bytes mapped for images and labels.
+    [[nodiscard]] size_t mappedBytes() const { return image_file.size() + label_file.size(); }
+
+    void gather(size_t first, size_t count, MatrixRef images, MatrixRef labels) const override {
+        const auto start = static_cast<Eigen::Index>(first);
+        const auto columns = static_cast<Eigen::Index>(count);
+
+        images = this->images().middleCols(start, columns).template cast<T>() / static_cast<T>(255);
+
+        labels.setZero();
+        ByteVectorView classes = this->labels();
+        for (Eigen::Index i = 0; i < columns; ++i) {
+            labels(classes(start + i), i) = static_cast<T>(1);
+        }
+    }
+
+    void gather(std::span<const size_t> indices, MatrixRef images, MatrixRef labels) const override {
+        ByteMatrixView pixels = this->images();
+        ByteVectorView classes = this->labels();
+
+        labels.setZero();
+        for (size_t i = 0; i < indices.size(); ++i) {
+            const auto column = static_cast<Eigen::Index>(i);
+            const auto index = static_cast<Eigen::Index>(indices[i]);
+            images.col(column) = pixels.col(index).template cast<T>() / static_cast<T>(255);
+            labels(classes(index), column) = static_cast<T>(1);
+        }
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+#include "image_io.hpp"
+#include "label_io.hpp"
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Header of an IDX file in host byte order. Label files have no rows/cols, those stay 1.
+struct IdxHeader {
+    uint32_t magic_number = 0;
+    uint32_t num_items = 0;
+    uint32_t num_rows = 1;
+    uint32_t num_cols = 1;
+
+    [[nodiscard]] size_t itemSize() const { return static_cast<size_t>(num_rows) * num_cols; }
+};
+
+// Size of the header preceding the payload of an IDX file with the given magic number.
+inline size_t idxHeaderSize(uint32_t magic_number) {
+    return magic_number == MAGIC_NUMBER_IMAGES ? IMAGE_HEADER_SIZE : LABEL_HEADER_SIZE;
+}
+
+// Parses and validates an IDX header from the first bytes of a file. Images must have IMAGE_SIZE
+// pixels, and the payload size announced by the header is checked against the actual file size, so
+// reads of the payload cannot run short.
+inline IdxHeader parseIdxHeader(const uint8_t* bytes, size_t file_size, uint32_t expected_magic, const std::string& path) {
+    const size_t header_size = idxHeaderSize(expected_magic);
+    if (file_size < header_size) {
+        throw std::runtime_error("Truncated IDX file: " + path);
+    }
+
+    auto word = [&](size_t index) {
+        uint32_t value;
+        std::memcpy(&value, bytes + index * sizeof(value), sizeof(value));
+        return __builtin_bswap32(value);
+    };
+
+    IdxHeader header;
+    header.magic_number = word(0);
+    if (header.magic_number != expected_magic) {
+        throw std::runtime_error("Unexpected magic number in IDX file: " + path);
+    }
+
+    header.num_items = word(1);
+    if (expected_magic == MAGIC_NUMBER_IMAGES) {
+        header.num_rows = word(2);
+        header.num_cols = word(3);
+
+        // The network reads exactly IMAGE_SIZE pixels per sample
+        if (header.itemSize() != IMAGE_SIZE) {
+            throw std::runtime_error("Unexpected image size in IDX file: " + path);
+        }
+    }
+
+    if (file_size < header_size + header.num_items * header.itemSize()) {
+        throw std::runtime_error("Truncated IDX file: " + path);
+    }
+
+    return header;
+}
+
+// Opens an IDX file once, validates its header and reads the complete payload with a single read.
+inline std::vector<uint8_t> readIdxPayload(const std::string& path, uint32_t expected_magic, IdxHeader& header) {
+    std::ifstream input_file(path, std::ios::binary | std::ios::ate);
+    if (!input_file.is_open()) {
+        throw std::runtime_error("File open failed: " + path);
+    }
+
+    const auto file_size = static_cast<size_t>(input_file.tellg());
+    input_file.seekg(0, std::ios::beg);
+
+    uint8_t header_bytes[IMAGE_HEADER_SIZE] = {};
+    input_file.read(reinterpret_cast<char*>(header_bytes), static_cast<std::streamsize>(std::min(file_size, idxHeaderSize(expected_magic))));
+    header = parseIdxHeader(header_bytes, file_size, expected_magic, path);
+
+    std::vector<uint8_t> payload(header.num_items * header.itemSize());
+    input_file.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+    if (!input_file) {
+        throw std::runtime_error("Reading IDX payload failed: " + path);
+    }
+
+    return payload;
+}
+
+// Image and label set loaded in one pass. Images are normalized to [0, 1] and stored one sample per
+// column, labels are one-hot encoded with the same column layout.
+template<typename T>
+struct IdxDataset {
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> images;
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> labels;
+    size_t bytes_read = 0;
+    double load_seconds = 0.0;
+
+    [[nodiscard]] size_t size() const { return static_cast<size_t>(images.cols()); }
+
+    // Raw IDX bytes read per second, in MB/s.
+    [[nodiscard]] double throughputMBps() const {
+        return load_seconds > 0.0 ? static_cast<double>(bytes_read) / 1e6 / load_seconds : 0.0;
+    }
+};
+
+template<typename T>
+IdxDataset<T> loadIdxDataset(const std::string& image_path, const std::string& label_path) {
+    auto timer_start = std::chrono::steady_clock::now();
+
+    IdxHeader image_header, label_header;
+    std::vector<uint8_t> pixels = readIdxPayload(image_path, MAGIC_NUMBER_IMAGES, image_header);
+    std::vector<uint8_t> classes = readIdxPayload(label_path, MAGIC_NUMBER_LABELS, label_header);
+
+    if (image_header.num_items != label_header.num_items) {
+        throw std::runtime_error("Image and label count differ: " + image_path + ", " + label_path);
+    }
+
+    IdxDataset<T> dataset;
+    const auto item_size = static_cast<Eigen::Index>(image_header.itemSize());
+    const auto num_items = static_cast<Eigen::Index>(image_header.num_items);
+
+    // Column-major storage puts every image into one contiguous column, matching the file layout.
+    using ByteMatrix = Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic>;
+    dataset.images = Eigen::Map<const ByteMatrix>(pixels.data(), item_size, num_items).template cast<T>()
+                     / static_cast<T>(255);
+
+    dataset.labels = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>::Zero(TENSOR_SIZE, num_items);
+    for (Eigen::Index i = 0; i < num_items; ++i) {
+        if (classes[i] >= TENSOR_SIZE) {
+            throw std::runtime_error("Label out of range in " + label_path);
+        }
+        dataset.labels(classes[i], i) = static_cast<T>(1);
+    }
+
+    dataset.bytes_read = IMAGE_HEADER_SIZE + pixels.size() + LABEL_HEADER_SIZE + classes.size();
+    dataset.load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - timer_start).count();
+
+    return dataset;
+}
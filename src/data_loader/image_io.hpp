@@ -1,3 +1,4 @@
+#pragma once
 #include "../tensor.hpp"
 #include <fstream>
 #include <iostream>
@@ -7,6 +8,7 @@
 
 const uint IMAGE_HEADER_SIZE = 16; // bytes for magic number
 const uint MAGIC_NUMBER_IMAGES = 0x803;
+const uint IMAGE_SIZE = 28 * 28; // pixels per image, the input size of the network
 
 // Function to normalize a vector of uint8 values to double values in the range 0.0 to 1.0
 template<typename T>
@@ -1,3 +1,4 @@
+#pragma once
 #include "../tensor.hpp"
 #include <fstream>
 #include <iostream>
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. The mapping is released when the object is destroyed.
+class MappedFile {
+private:
+    const uint8_t* mapped_data = nullptr;
+    size_t mapped_size = 0;
+
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("File open failed: " + path);
+        }
+
+        struct stat file_stat {};
+        if (::fstat(fd, &file_stat) != 0) {
+            ::close(fd);
+            throw std::runtime_error("File stat failed: " + path);
+        }
+        mapped_size = static_cast<size_t>(file_stat.st_size);
+
+        if (mapped_size > 0) {
+            void* data = ::mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("File mmap failed: " + path);
+            }
+            mapped_data = static_cast<const uint8_t*>(data);
+        }
+
+        // The mapping stays valid after the descriptor is closed.
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+            : mapped_data(std::exchange(other.mapped_data, nullptr)), mapped_size(std::exchange(other.mapped_size, 0)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            mapped_data = std::exchange(other.mapped_data, nullptr);
+            mapped_size = std::exchange(other.mapped_size, 0);
+        }
+        return *this;
+    }
+
+    ~MappedFile() { unmap(); }
+
+    [[nodiscard]] const uint8_t* data() const { return mapped_data; }
+    [[nodiscard]] size_t size() const { return mapped_size; }
+
+    // Hints the kernel about the expected access pattern, e.g. MADV_SEQUENTIAL or MADV_WILLNEED.
+    void advise(int advice) const {
+        if (mapped_data != nullptr) {
+            ::madvise(const_cast<uint8_t*>(mapped_data), mapped_size, advice);
+        }
+    }
+
+private:
+    void unmap() {
+        if (mapped_data != nullptr) {
+            ::munmap(const_cast<uint8_t*>(mapped_data), mapped_size);
+            mapped_data = nullptr;
+            mapped_size = 0;
+        }
+    }
+};
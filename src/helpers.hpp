@@ -3,39 +3,10 @@
 #include <iostream>
 #include <map>
 #include <fstream>
+#include <sstream>
+#include <string>
 
 
-const uint32_t LABEL_MAGIC_NUMBER = 0x801;
-
-// takes a path to a file and returns the number of items in the file
-static size_t getItemCount(const std::string& path) {
-    std::ifstream input_file(path, std::ios::binary);
-    assert(input_file.is_open());
-
-    uint32_t magic_number, num_items;
-    input_file.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-    magic_number = __builtin_bswap32(magic_number);
-    input_file.read(reinterpret_cast<char*>(&num_items), sizeof(num_items));
-    num_items = __builtin_bswap32(num_items);
-
-    assert(magic_number == LABEL_MAGIC_NUMBER);
-
-    return num_items;
-}
-
-static void logPrediction(int prediction, int label, int image_index, const std::string& filename) {
-    // Open the file in append mode
-    std::ofstream file(filename, std::ios::app);
-    if (!file) {
-        std::cerr << "Unable to open file for writing.\n";
-        return;
-    }
-
-    file << " - image " << image_index << ": Prediction=" << prediction << ". Label=" << label << "\n";
-
-    file.close();
-}
-
 static std::map<std::string, std::string> parseConfigfile(std::ifstream& configfile) {
     std::string line;
     std::map<std::string, std::string> config;
@@ -62,3 +33,17 @@ static std::map<std::string, std::string> parseConfigfile(std::ifstream& configf
 
     return config;
 }
+
+
+// parses a comma separated list of sizes such as "1, 8, 32"
+static std::vector<size_t> parseSizeList(const std::string& list) {
+    std::vector<size_t> sizes;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(item.find_first_not_of(" \t") != std::string::npos) {
+            sizes.push_back(std::stoul(item));
+        }
+    }
+    return sizes;
+}
@@ -0,0 +1,621 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NN_X86_KERNELS 1
+#endif
+
+// Vector instruction sets the kernels below are compiled for. Every kernel is built for all of them
+// through target attributes, independent of the compiler flags, and dispatched at runtime.
+enum class SimdLevel
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// Widest instruction set supported by the CPU.
+inline SimdLevel detectSimdLevel()
+{
+#ifdef NN_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+// Instruction set the kernels dispatch to. Defaults to the detected one and may be lowered, e.g. to
+// benchmark the fallbacks; it must not be raised above what the CPU supports.
+inline SimdLevel& activeSimdLevel()
+{
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline const char* simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+        case SimdLevel::AVX512:
+            return "avx512";
+        case SimdLevel::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+// Scalar reference kernels, also used for element types without vector kernels.
+template< typename T >
+T dotScalar(const T* a, const T* b, size_t n)
+{
+    T sum = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template< typename T >
+void axpyScalar(T alpha, const T* x, T* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        y[i] += alpha * x[i];
+    }
+}
+
+// Adds a * b to the row c, where a is a row of k values lda apart and b a k x n block with rows
+// ldb apart.
+template< typename T >
+void gemmRowScalar(const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t k, size_t n)
+{
+    for (size_t i = 0; i < k; i++)
+    {
+        axpyScalar(a[i * lda], b + i * ldb, c, n);
+    }
+}
+
+#ifdef NN_X86_KERNELS
+
+// The dot products keep four independent accumulators to hide the latency of the fused multiply-adds.
+
+__attribute__((target("avx2,fma")))
+inline double dotAvx2(const double* a, const double* b, size_t n)
+{
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+        acc2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 8), _mm256_loadu_pd(b + i + 8), acc2);
+        acc3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 12), _mm256_loadu_pd(b + i + 12), acc3);
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+    }
+
+    __m256d acc = _mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3));
+    __m128d low = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    double sum = _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+
+    return sum + dotScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline float dotAvx2(const float* a, const float* b, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 low = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+    float sum = _mm_cvtss_f32(_mm_add_ss(low, _mm_movehdup_ps(low)));
+
+    return sum + dotScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline void axpyAvx2(double alpha, const double* x, double* y, size_t n)
+{
+    const __m256d factor = _mm256_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(factor, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    axpyScalar(alpha, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline void axpyAvx2(float alpha, const float* x, float* y, size_t n)
+{
+    const __m256 factor = _mm256_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(factor, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    axpyScalar(alpha, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+inline double dotAvx512(const double* a, const double* b, size_t n)
+{
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    __m512d acc2 = _mm512_setzero_pd(), acc3 = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), acc1);
+        acc2 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 16), _mm512_loadu_pd(b + i + 16), acc2);
+        acc3 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 24), _mm512_loadu_pd(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+    }
+
+    // The remainder is handled with a masked load instead of a scalar loop
+    const __mmask8 tail = static_cast< __mmask8 >((1u << (n - i)) - 1);
+    acc1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, a + i), _mm512_maskz_loadu_pd(tail, b + i), acc1);
+
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(acc0, acc1), _mm512_add_pd(acc2, acc3)));
+}
+
+__attribute__((target("avx512f")))
+inline float dotAvx512(const float* a, const float* b, size_t n)
+{
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+
+    const __mmask16 tail = static_cast< __mmask16 >((1u << (n - i)) - 1);
+    acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, a + i), _mm512_maskz_loadu_ps(tail, b + i), acc1);
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+__attribute__((target("avx512f")))
+inline void axpyAvx512(double alpha, const double* x, double* y, size_t n)
+{
+    const __m512d factor = _mm512_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(factor, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+    }
+
+    const __mmask8 tail = static_cast< __mmask8 >((1u << (n - i)) - 1);
+    _mm512_mask_storeu_pd(y + i, tail, _mm512_fmadd_pd(factor, _mm512_maskz_loadu_pd(tail, x + i), _mm512_maskz_loadu_pd(tail, y + i)));
+}
+
+__attribute__((target("avx512f")))
+inline void axpyAvx512(float alpha, const float* x, float* y, size_t n)
+{
+    const __m512 factor = _mm512_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(factor, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    }
+
+    const __mmask16 tail = static_cast< __mmask16 >((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(y + i, tail, _mm512_fmadd_ps(factor, _mm512_maskz_loadu_ps(tail, x + i), _mm512_maskz_loadu_ps(tail, y + i)));
+}
+
+// The row kernels keep a strip of four vectors of c in registers over all k and write it back once.
+
+__attribute__((target("avx2,fma")))
+inline void gemmRowAvx2(const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t k, size_t n)
+{
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16)
+    {
+        __m256d acc0 = _mm256_loadu_pd(c + j), acc1 = _mm256_loadu_pd(c + j + 4);
+        __m256d acc2 = _mm256_loadu_pd(c + j + 8), acc3 = _mm256_loadu_pd(c + j + 12);
+        for (size_t i = 0; i < k; i++)
+        {
+            const __m256d factor = _mm256_set1_pd(a[i * lda]);
+            const double* row = b + i * ldb + j;
+            acc0 = _mm256_fmadd_pd(factor, _mm256_loadu_pd(row), acc0);
+            acc1 = _mm256_fmadd_pd(factor, _mm256_loadu_pd(row + 4), acc1);
+            acc2 = _mm256_fmadd_pd(factor, _mm256_loadu_pd(row + 8), acc2);
+            acc3 = _mm256_fmadd_pd(factor, _mm256_loadu_pd(row + 12), acc3);
+        }
+        _mm256_storeu_pd(c + j, acc0);
+        _mm256_storeu_pd(c + j + 4, acc1);
+        _mm256_storeu_pd(c + j + 8, acc2);
+        _mm256_storeu_pd(c + j + 12, acc3);
+    }
+    for (; j + 4 <= n; j += 4)
+    {
+        __m256d acc = _mm256_loadu_pd(c + j);
+        for (size_t i = 0; i < k; i++)
+        {
+            acc = _mm256_fmadd_pd(_mm256_set1_pd(a[i * lda]), _mm256_loadu_pd(b + i * ldb + j), acc);
+        }
+        _mm256_storeu_pd(c + j, acc);
+    }
+    gemmRowScalar(a, lda, b + j, ldb, c + j, k, n - j);
+}
+
+__attribute__((target("avx2,fma")))
+inline void gemmRowAvx2(const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t k, size_t n)
+{
+    size_t j = 0;
+    for (; j + 32 <= n; j += 32)
+    {
+        __m256 acc0 = _mm256_loadu_ps(c + j), acc1 = _mm256_loadu_ps(c + j + 8);
+        __m256 acc2 = _mm256_loadu_ps(c + j + 16), acc3 = _mm256_loadu_ps(c + j + 24);
+        for (size_t i = 0; i < k; i++)
+        {
+            const __m256 factor = _mm256_set1_ps(a[i * lda]);
+            const float* row = b + i * ldb + j;
+            acc0 = _mm256_fmadd_ps(factor, _mm256_loadu_ps(row), acc0);
+            acc1 = _mm256_fmadd_ps(factor, _mm256_loadu_ps(row + 8), acc1);
+            acc2 = _mm256_fmadd_ps(factor, _mm256_loadu_ps(row + 16), acc2);
+            acc3 = _mm256_fmadd_ps(factor, _mm256_loadu_ps(row + 24), acc3);
+        }
+        _mm256_storeu_ps(c + j, acc0);
+        _mm256_storeu_ps(c + j + 8, acc1);
+        _mm256_storeu_ps(c + j + 16, acc2);
+        _mm256_storeu_ps(c + j + 24, acc3);
+    }
+    for (; j + 8 <= n; j += 8)
+    {
+        __m256 acc = _mm256_loadu_ps(c + j);
+        for (size_t i = 0; i < k; i++)
+        {
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(a[i * lda]), _mm256_loadu_ps(b + i * ldb + j), acc);
+        }
+        _mm256_storeu_ps(c + j, acc);
+    }
+    gemmRowScalar(a, lda, b + j, ldb, c + j, k, n - j);
+}
+
+__attribute__((target("avx512f")))
+inline void gemmRowAvx512(const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t k, size_t n)
+{
+    size_t j = 0;
+    for (; j + 32 <= n; j += 32)
+    {
+        __m512d acc0 = _mm512_loadu_pd(c + j), acc1 = _mm512_loadu_pd(c + j + 8);
+        __m512d acc2 = _mm512_loadu_pd(c + j + 16), acc3 = _mm512_loadu_pd(c + j + 24);
+        for (size_t i = 0; i < k; i++)
+        {
+            const __m512d factor = _mm512_set1_pd(a[i * lda]);
+            const double* row = b + i * ldb + j;
+            acc0 = _mm512_fmadd_pd(factor, _mm512_loadu_pd(row), acc0);
+            acc1 = _mm512_fmadd_pd(factor, _mm512_loadu_pd(row + 8), acc1);
+            acc2 = _mm512_fmadd_pd(factor, _mm512_loadu_pd(row + 16), acc2);
+            acc3 = _mm512_fmadd_pd(factor, _mm512_loadu_pd(row + 24), acc3);
+        }
+        _mm512_storeu_pd(c + j, acc0);
+        _mm512_storeu_pd(c + j + 8, acc1);
+        _mm512_storeu_pd(c + j + 16, acc2);
+        _mm512_storeu_pd(c + j + 24, acc3);
+    }
+    for (; j < n; j += 8)
+    {
+        const __mmask8 mask = n - j >= 8 ? static_cast< __mmask8 >(0xFF) : static_cast< __mmask8 >((1u << (n - j)) - 1);
+        __m512d acc = _mm512_maskz_loadu_pd(mask, c + j);
+        for (size_t i = 0; i < k; i++)
+        {
+            acc = _mm512_fmadd_pd(_mm512_set1_pd(a[i * lda]), _mm512_maskz_loadu_pd(mask, b + i * ldb + j), acc);
+        }
+        _mm512_mask_storeu_pd(c + j, mask, acc);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void gemmRowAvx512(const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t k, size_t n)
+{
+    size_t j = 0;
+    for (; j + 64 <= n; j += 64)
+    {
+        __m512 acc0 = _mm512_loadu_ps(c + j), acc1 = _mm512_loadu_ps(c + j + 16);
+        __m512 acc2 = _mm512_loadu_ps(c + j + 32), acc3 = _mm512_loadu_ps(c + j + 48);
+        for (size_t i = 0; i < k; i++)
+        {
+            const __m512 factor = _mm512_set1_ps(a[i * lda]);
+            const float* row = b + i * ldb + j;
+            acc0 = _mm512_fmadd_ps(factor, _mm512_loadu_ps(row), acc0);
+            acc1 = _mm512_fmadd_ps(factor, _mm512_loadu_ps(row + 16), acc1);
+            acc2 = _mm512_fmadd_ps(factor, _mm512_loadu_ps(row + 32), acc2);
+            acc3 = _mm512_fmadd_ps(factor, _mm512_loadu_ps(row + 48), acc3);
+        }
+        _mm512_storeu_ps(c + j, acc0);
+        _mm512_storeu_ps(c + j + 16, acc1);
+        _mm512_storeu_ps(c + j + 32, acc2);
+        _mm512_storeu_ps(c + j + 48, acc3);
+    }
+    for (; j < n; j += 16)
+    {
+        const __mmask16 mask = n - j >= 16 ? static_cast< __mmask16 >(0xFFFF) : static_cast< __mmask16 >((1u << (n - j)) - 1);
+        __m512 acc = _mm512_maskz_loadu_ps(mask, c + j);
+        for (size_t i = 0; i < k; i++)
+        {
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(a[i * lda]), _mm512_maskz_loadu_ps(mask, b + i * ldb + j), acc);
+        }
+        _mm512_mask_storeu_ps(c + j, mask, acc);
+    }
+}
+
+#endif
+
+template< typename T >
+constexpr bool hasVectorKernels = std::is_same_v< T, float > || std::is_same_v< T, double >;
+
+// Returns the dot product of a[0, n) and b[0, n) with the active instruction set.
+template< typename T >
+T dot(const T* a, const T* b, size_t n)
+{
+#ifdef NN_X86_KERNELS
+    if constexpr (hasVectorKernels< T >)
+    {
+        switch (activeSimdLevel())
+        {
+            case SimdLevel::AVX512:
+                return dotAvx512(a, b, n);
+            case SimdLevel::AVX2:
+                return dotAvx2(a, b, n);
+            default:
+                break;
+        }
+    }
+#endif
+    return dotScalar(a, b, n);
+}
+
+// Computes y[0, n) += alpha * x[0, n) with the active instruction set.
+template< typename T >
+void axpy(T alpha, const T* x, T* y, size_t n)
+{
+#ifdef NN_X86_KERNELS
+    if constexpr (hasVectorKernels< T >)
+    {
+        switch (activeSimdLevel())
+        {
+            case SimdLevel::AVX512:
+                axpyAvx512(alpha, x, y, n);
+                return;
+            case SimdLevel::AVX2:
+                axpyAvx2(alpha, x, y, n);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+    axpyScalar(alpha, x, y, n);
+}
+
+// Adds a * b to the row c with the active instruction set, where a is a row of k values lda apart
+// and b a k x n block of a row-major matrix whose rows are ldb apart.
+template< typename T >
+void gemmRow(const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t k, size_t n)
+{
+#ifdef NN_X86_KERNELS
+    if constexpr (hasVectorKernels< T >)
+    {
+        switch (activeSimdLevel())
+        {
+            case SimdLevel::AVX512:
+                gemmRowAvx512(a, lda, b, ldb, c, k, n);
+                return;
+            case SimdLevel::AVX2:
+                gemmRowAvx2(a, lda, b, ldb, c, k, n);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+    gemmRowScalar(a, lda, b, ldb, c, k, n);
+}
+
+// Instruction sets of the 8 bit integer dot product, detected separately from SimdLevel since the
+// VNNI extensions come and go independently of the float ones. VNNI multiplies unsigned by signed
+// bytes and adds each group of four products into a 32 bit lane in one instruction; plain AVX2
+// needs maddubs, which adds pairs of products into 16 bits with saturation, and a madd to widen.
+enum class IntegerDotLevel
+{
+    Scalar,
+    AVX2,
+    AVXVNNI,
+    AVX512VNNI
+};
+
+inline IntegerDotLevel detectIntegerDotLevel()
+{
+#ifdef NN_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw"))
+    {
+        return IntegerDotLevel::AVX512VNNI;
+    }
+    if (__builtin_cpu_supports("avxvnni"))
+    {
+        return IntegerDotLevel::AVXVNNI;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return IntegerDotLevel::AVX2;
+    }
+#endif
+    return IntegerDotLevel::Scalar;
+}
+
+// Instruction set dotU8S8 dispatches to, with the same rules as activeSimdLevel.
+inline IntegerDotLevel& activeIntegerDotLevel()
+{
+    static IntegerDotLevel level = detectIntegerDotLevel();
+    return level;
+}
+
+inline const char* integerDotLevelName(IntegerDotLevel level)
+{
+    switch (level)
+    {
+        case IntegerDotLevel::AVX512VNNI:
+            return "avx512-vnni";
+        case IntegerDotLevel::AVXVNNI:
+            return "avx-vnni";
+        case IntegerDotLevel::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+inline int32_t dotU8S8Scalar(const uint8_t* a, const int8_t* b, size_t n)
+{
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += static_cast< int32_t >(a[i]) * b[i];
+    }
+    return sum;
+}
+
+#ifdef NN_X86_KERNELS
+
+__attribute__((target("avx2")))
+inline int32_t reduceAddAvx2(__m256i acc)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+inline int32_t dotU8S8Avx2(const uint8_t* a, const int8_t* b, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        const __m256i pairs0 = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i)),
+                                                    _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i)));
+        const __m256i pairs1 = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i + 32)),
+                                                    _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i + 32)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(pairs0, ones));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(pairs1, ones));
+    }
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m256i pairs = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i)),
+                                                   _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(pairs, ones));
+    }
+
+    return reduceAddAvx2(_mm256_add_epi32(acc0, acc1)) + dotU8S8Scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,avxvnni")))
+inline int32_t dotU8S8AvxVnni(const uint8_t* a, const int8_t* b, size_t n)
+{
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        acc0 = _mm256_dpbusd_avx_epi32(acc0, _mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i)),
+                                       _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i)));
+        acc1 = _mm256_dpbusd_avx_epi32(acc1, _mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i + 32)),
+                                       _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i + 32)));
+    }
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm256_dpbusd_avx_epi32(acc0, _mm256_loadu_si256(reinterpret_cast< const __m256i* >(a + i)),
+                                       _mm256_loadu_si256(reinterpret_cast< const __m256i* >(b + i)));
+    }
+
+    return reduceAddAvx2(_mm256_add_epi32(acc0, acc1)) + dotU8S8Scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+inline int32_t dotU8S8Avx512Vnni(const uint8_t* a, const int8_t* b, size_t n)
+{
+    __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128)
+    {
+        acc0 = _mm512_dpbusd_epi32(acc0, _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        acc1 = _mm512_dpbusd_epi32(acc1, _mm512_loadu_si512(a + i + 64), _mm512_loadu_si512(b + i + 64));
+    }
+    for (; i + 64 <= n; i += 64)
+    {
+        acc0 = _mm512_dpbusd_epi32(acc0, _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    }
+
+    const __mmask64 tail = (uint64_t(1) << (n - i)) - 1;
+    acc1 = _mm512_dpbusd_epi32(acc1, _mm512_maskz_loadu_epi8(tail, a + i), _mm512_maskz_loadu_epi8(tail, b + i));
+
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+
+#endif
+
+// Returns the dot product of the unsigned bytes a[0, n) and the signed bytes b[0, n) with the active
+// instruction set. The values of a must not exceed 127: the saturating pair sums of the AVX2 kernel
+// are exact only then, and all instruction sets agree bit for bit.
+inline int32_t dotU8S8(const uint8_t* a, const int8_t* b, size_t n)
+{
+#ifdef NN_X86_KERNELS
+    switch (activeIntegerDotLevel())
+    {
+        case IntegerDotLevel::AVX512VNNI:
+            return dotU8S8Avx512Vnni(a, b, n);
+        case IntegerDotLevel::AVXVNNI:
+            return dotU8S8AvxVnni(a, b, n);
+        case IntegerDotLevel::AVX2:
+            return dotU8S8Avx2(a, b, n);
+        default:
+            break;
+    }
+#endif
+    return dotU8S8Scalar(a, b, n);
+}
@@ -1,35 +1,145 @@
 #pragma once
+#include "arena.hpp"
+#include "backends.hpp"
 #include <eigen3/Eigen/Dense>
 #include <string>
 #include <memory>
 #include <cmath>
 #include <random>
+#include <vector>
+#include <cstdint>
+
+// Dynamically sized Eigen types for a given scalar type (float or double).
+template<typename Scalar>
+using MatrixX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+template<typename Scalar>
+using VectorX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+template<typename Scalar>
+using RowVectorX = Eigen::Matrix<Scalar, 1, Eigen::Dynamic>;
+
+// Kinds of layers, as recorded in checkpoints.
+enum class LayerType : uint32_t {
+    FullyConnected = 1,
+    ReLU = 2,
+    SoftMax = 3,
+    FullyConnectedReLU = 4
+};
+
+inline const char* layerTypeName(LayerType type) {
+    switch (type) {
+        case LayerType::FullyConnected:
+            return "FullyConnected";
+        case LayerType::ReLU:
+            return "ReLU";
+        case LayerType::SoftMax:
+            return "SoftMax";
+        case LayerType::FullyConnectedReLU:
+            return "FullyConnectedReLU";
+        default:
+            return "unknown";
+    }
+}
+
+// Buffers of one layer that belong to a single pass through the network rather than to the layer:
+// the output of the forward pass, the input gradient of the backward pass, the parameter gradients
+// and the scratch of the matrix products. Their storage is carved from an arena by BaseLayer::prepare for the largest batch and
+// then only written to, so passes through the network do not allocate.
+template<typename Scalar>
+struct LayerState {
+    MatrixMap<Scalar> output{nullptr, 0, 0};         // Output batch of the forward pass (features x batch capacity).
+    MatrixMap<Scalar> inputGradient{nullptr, 0, 0};  // Gradient with respect to the input, empty if not needed.
+    MatrixMap<Scalar> weightGradient{nullptr, 0, 0}; // Weight gradient summed over the samples of the pass.
+    VectorMap<Scalar> biasGradient{nullptr, 0};      // Bias gradient summed over the samples of the pass.
+    MatrixMap<Scalar> maskedGradient{nullptr, 0, 0}; // Output gradient after the fused activation, empty for unfused layers.
+    VectorMap<Scalar> packing{nullptr, 0};           // Packed operand panels of the matrix products (see backends.hpp).
+
+    // Adds the parameter gradients of another state, used to reduce per-thread gradients.
+    void accumulate(const LayerState& other) {
+        if (other.weightGradient.size() != 0) {
+            weightGradient += other.weightGradient;
+            biasGradient += other.biasGradient;
+        }
+    }
+};
 
 // Base class for all layer types in a neural network.
 // It defines the interface for the forward and backward pass operations.
+// Inputs and gradients are batches with one sample per column (features x batch).
+// Layers only hold their parameters and are const during passes: all results are written into
+// caller-owned buffers, so one layer can serve any number of threads at once.
+template<typename Scalar>
 class BaseLayer {
 public:
-    // Forward pass takes an input vector and returns the layer's output vector.
-    virtual Eigen::VectorXd forward(const Eigen::VectorXd& input) = 0;
+    using Matrix = MatrixX<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
+    using MatrixRef = Eigen::Ref<Matrix>;
+
+    // Kind of the layer.
+    virtual LayerType type() const = 0;
+
+    // Trainable parameter blocks of the layer in a fixed order, vectors as one-column matrices.
+    // Layers without parameters have none.
+    virtual std::vector<ConstRef> parameters() const {
+        return {};
+    }
+
+    virtual std::vector<MatrixRef> parameters() {
+        return {};
+    }
 
-    // Backward pass takes a gradient vector from the next layer and returns
-    // the gradient vector with respect to the input of this layer.
-    virtual Eigen::VectorXd backward(const Eigen::VectorXd& gradient) = 0;
+    // Number of output features for the given number of input features.
+    virtual Eigen::Index outputRows(Eigen::Index inputRows) const {
+        return inputRows;
+    }
+
+    // Binds the buffers of a state to arena storage for batches of up to batchColumns samples.
+    // Gradient buffers are only reserved for training, the input gradient only if the previous
+    // layer needs it.
+    virtual void prepare(LayerState<Scalar>& state, Arena& arena, Eigen::Index inputRows, Eigen::Index batchColumns,
+                         bool withGradients, bool needsInputGradient) const {
+        arena.bind(state.output, outputRows(inputRows), batchColumns);
+        arena.bind(state.inputGradient, withGradients && needsInputGradient ? inputRows : 0, batchColumns);
+    }
+
+    // Forward pass writes the layer's output batch for the input batch into output, using the
+    // scratch buffers of the state.
+    virtual void forward(const ConstRef& input, MatrixRef output, LayerState<Scalar>& state) const = 0;
+
+    // Backward pass takes the input and output of the forward pass and the gradient batch from the
+    // next layer. It stores the parameter gradients in the state and writes the gradient with respect
+    // to the input into inputGradient, unless inputGradient is empty.
+    virtual void backward(const ConstRef& input, const ConstRef& output, const ConstRef& gradient,
+                          MatrixRef inputGradient, LayerState<Scalar>& state) const = 0;
+
+    // Updates the parameters with the gradients of a state. Layers without parameters ignore it.
+    virtual void applyGradients(const LayerState<Scalar>&, Scalar) {}
+
+    // Like applyGradients, but may skip parameters whose gradient is known to be zero. Used by
+    // lock-free asynchronous training, where fewer writes mean fewer conflicts between threads.
+    virtual void applySparseGradients(const LayerState<Scalar>& state, Scalar learningRate) {
+        applyGradients(state, learningRate);
+    }
 
     // Virtual destructor to allow derived class objects to be deleted correctly.
     virtual ~BaseLayer() = default;
 };
 
-// Fully connected (dense) layer implementation.
-class FullyConnectedLayer : public BaseLayer {
-    Eigen::MatrixXd weights; // Matrix of weights for the layer.
-    Eigen::VectorXd biases;  // Vector of biases for the layer.
-    Eigen::VectorXd inputCache; // Cached input vector for use in backward pass.
-    double learningRate; // Learning rate for parameter updates.
+// Fully connected (dense) layer implementation. The matrix products and parameter updates are
+// carried out by the Backend policy (see backends.hpp).
+template<typename Scalar, typename Backend = EigenBackend<Scalar>>
+class FullyConnectedLayer : public BaseLayer<Scalar> {
+protected:
+    using Matrix = MatrixX<Scalar>;
+    using Vector = VectorX<Scalar>;
+    using ConstRef = typename BaseLayer<Scalar>::ConstRef;
+    using MatrixRef = typename BaseLayer<Scalar>::MatrixRef;
+
+    Matrix weights; // Matrix of weights for the layer.
+    Vector biases;  // Vector of biases for the layer.
 
 public:
-    // Constructor to initialize layer with given input and output sizes, and learning rate.
-    FullyConnectedLayer(int inputSize, int outputSize, double lr) : learningRate(lr) {
+    // Constructor to initialize layer with given input and output sizes.
+    FullyConnectedLayer(int inputSize, int outputSize) {
         // Random number generator for initializing weights and biases.
         // std::random_device is used to obtain a seed for the random number engine.
         // std::mt19937 is a standard mersenne_twister_engine seeded with rd().
@@ -37,82 +147,185 @@ public:
         std::mt19937 gen(rd());
 
         // He initialization for weight parameters, beneficial for layers before ReLU activations.
-        double stddev = sqrt(2.0 / inputSize);
-        std::normal_distribution<> d(0, stddev);
+        Scalar stddev = std::sqrt(Scalar(2) / static_cast<Scalar>(inputSize));
+        std::normal_distribution<Scalar> d(0, stddev);
 
         // Initialize weights and biases using He initialization for weights and zeros for biases.
-        weights = Eigen::MatrixXd(outputSize, inputSize).unaryExpr([&](double) { return d(gen); });
-        biases = Eigen::VectorXd::Zero(outputSize);
+        weights = Matrix(outputSize, inputSize).unaryExpr([&](Scalar) { return d(gen); });
+        biases = Vector::Zero(outputSize);
+    }
+
+    LayerType type() const override {
+        return LayerType::FullyConnected;
+    }
+
+    std::vector<ConstRef> parameters() const override {
+        return {weights, biases};
+    }
+
+    std::vector<MatrixRef> parameters() override {
+        return {weights, biases};
+    }
+
+    Eigen::Index outputRows(Eigen::Index) const override {
+        return weights.rows();
+    }
+
+    void prepare(LayerState<Scalar>& state, Arena& arena, Eigen::Index inputRows, Eigen::Index batchColumns,
+                 bool withGradients, bool needsInputGradient) const override {
+        BaseLayer<Scalar>::prepare(state, arena, inputRows, batchColumns, withGradients, needsInputGradient);
+        arena.bind(state.weightGradient, withGradients ? weights.rows() : 0, weights.cols());
+        arena.bind(state.biasGradient, withGradients ? biases.size() : 0);
+        arena.bind(state.packing, Backend::packingSize(weights.rows(), weights.cols(), batchColumns, withGradients));
     }
 
     // Performs the forward pass of the layer: computes the weighted sum of inputs and biases.
-    Eigen::VectorXd forward(const Eigen::VectorXd& input) override {
-        inputCache = input; // Cache input for use in backward pass.
-        return (weights * input + biases).eval(); // Compute output.
+    // For a batch this is a single matrix-matrix product.
+    void forward(const ConstRef& input, MatrixRef output, LayerState<Scalar>& state) const override {
+        Backend::multiply(weights, input, output, state.packing); // Compute output.
+        output.colwise() += biases;
     }
 
-    // Performs the backward pass of the layer: computes gradients and updates parameters.
-    Eigen::VectorXd backward(const Eigen::VectorXd& gradient) override {
-        // Compute gradients for weights and biases using outer product of gradient and cached input.
-        Eigen::MatrixXd dWeights = gradient * inputCache.transpose();
-        const Eigen::VectorXd& dBiases = gradient;
+    // Performs the backward pass of the layer: computes the parameter gradients into the state.
+    // The incoming gradient already carries the 1/batch factor of the mean loss, so the gradients
+    // are summed over the samples and applied once per batch by applyGradients.
+    void backward(const ConstRef& input, const ConstRef&, const ConstRef& gradient,
+                  MatrixRef inputGradient, LayerState<Scalar>& state) const override {
+        // Compute gradients for weights and biases, accumulated over all samples of the batch.
+        Backend::weightGradient(gradient, input, state.weightGradient, state.packing);
+        state.biasGradient.noalias() = gradient.rowwise().sum();
+
+        // Gradient with respect to the input for use in previous layer's backward pass.
+        if (inputGradient.size() != 0) {
+            Backend::inputGradient(weights, gradient, inputGradient, state.packing);
+        }
+    }
 
-        // Update weights and biases using the calculated gradients and learning rate.
-        weights -= learningRate * dWeights;
-        biases -= learningRate * dBiases;
+    // Update weights and biases in place using the calculated gradients and learning rate.
+    void applyGradients(const LayerState<Scalar>& state, Scalar learningRate) override {
+        Backend::update(weights.data(), state.weightGradient.data(), static_cast<size_t>(weights.size()), learningRate);
+        Backend::update(biases.data(), state.biasGradient.data(), static_cast<size_t>(biases.size()), learningRate);
+    }
 
-        // Return gradient with respect to the input for use in previous layer's backward pass.
-        return weights.transpose() * gradient;
+    // Only updates the weight columns with a non-zero gradient. A column is exactly zero when its
+    // input was zero for every sample of the batch; for MNIST this skips the always-black border
+    // pixels and the hidden units the ReLU switched off.
+    void applySparseGradients(const LayerState<Scalar>& state, Scalar learningRate) override {
+        for (Eigen::Index column = 0; column < weights.cols(); ++column) {
+            if (!state.weightGradient.col(column).isZero(0)) {
+                Backend::update(weights.col(column).data(), state.weightGradient.col(column).data(),
+                                static_cast<size_t>(weights.rows()), learningRate);
+            }
+        }
+        Backend::update(biases.data(), state.biasGradient.data(), static_cast<size_t>(biases.size()), learningRate);
+    }
+};
+
+// Fully connected layer with the ReLU activation fused in. The forward pass adds the biases and
+// clamps in the same sweep over the product, so the pre-activation batch is never stored and the
+// separate ReLU layer with its own output buffer disappears. The backward pass takes the mask from
+// the sign of the output, which is positive exactly where the activation let the gradient through,
+// and masks the incoming gradient once into the state before the parameter products.
+template<typename Scalar, typename Backend = EigenBackend<Scalar>>
+class FullyConnectedReLULayer : public FullyConnectedLayer<Scalar, Backend> {
+    using Base = FullyConnectedLayer<Scalar, Backend>;
+    using ConstRef = typename Base::ConstRef;
+    using MatrixRef = typename Base::MatrixRef;
+
+public:
+    using Base::Base;
+
+    LayerType type() const override {
+        return LayerType::FullyConnectedReLU;
+    }
+
+    void prepare(LayerState<Scalar>& state, Arena& arena, Eigen::Index inputRows, Eigen::Index batchColumns,
+                 bool withGradients, bool needsInputGradient) const override {
+        Base::prepare(state, arena, inputRows, batchColumns, withGradients, needsInputGradient);
+        arena.bind(state.maskedGradient, withGradients ? this->weights.rows() : 0, batchColumns);
+    }
+
+    // Computes max(0, Wx + b) for every column of the input batch.
+    void forward(const ConstRef& input, MatrixRef output, LayerState<Scalar>& state) const override {
+        Backend::multiply(this->weights, input, output, state.packing);
+        output = (output.colwise() + this->biases).cwiseMax(Scalar(0));
+    }
+
+    // Masks the gradient with the output sign, then continues as the dense layer on the masked gradient.
+    void backward(const ConstRef& input, const ConstRef& output, const ConstRef& gradient,
+                  MatrixRef inputGradient, LayerState<Scalar>& state) const override {
+        auto masked = state.maskedGradient.leftCols(gradient.cols());
+        masked = (output.array() > Scalar(0)).select(gradient, Scalar(0));
+        Base::backward(input, output, masked, inputGradient, state);
     }
 };
 
 // Rectified Linear Unit (ReLU) activation layer.
-class ReLU : public BaseLayer {
-    Eigen::VectorXd inputCache; // Cached input vector for use in backward pass.
+template<typename Scalar>
+class ReLU : public BaseLayer<Scalar> {
+    using ConstRef = typename BaseLayer<Scalar>::ConstRef;
+    using MatrixRef = typename BaseLayer<Scalar>::MatrixRef;
 
 public:
-    // Performs the ReLU operation on the input vector.
-    Eigen::VectorXd forward(const Eigen::VectorXd& input) override {
-        inputCache = input; // Cache input for use in backward pass.
+    LayerType type() const override {
+        return LayerType::ReLU;
+    }
+
+    // Performs the ReLU operation on the input batch.
+    void forward(const ConstRef& input, MatrixRef output, LayerState<Scalar>&) const override {
         // Apply ReLU function element-wise: max(0, x).
-        return input.unaryExpr([](double x) { return std::max(0.0, x); });
+        output = input.cwiseMax(Scalar(0));
     }
 
     // Computes gradient of ReLU function during backward pass.
-    Eigen::VectorXd backward(const Eigen::VectorXd& gradient) override {
-        // Apply element-wise gradient of ReLU: 1 for x > 0, otherwise 0.
-        Eigen::VectorXd gradInput = gradient.cwiseProduct(inputCache.unaryExpr([](double x) { return x > 0 ? 1.0 : 0.0; }));
-        return gradInput;
+    void backward(const ConstRef&, const ConstRef& output, const ConstRef& gradient,
+                  MatrixRef inputGradient, LayerState<Scalar>&) const override {
+        // Apply element-wise gradient of ReLU: 1 for x > 0, otherwise 0. The output is positive
+        // exactly where the input was.
+        if (inputGradient.size() != 0) {
+            inputGradient = (output.array() > Scalar(0)).select(gradient, Scalar(0));
+        }
     }
 };
 
+// Column-wise softmax of a batch, written into output. The max coefficient of every column is
+// subtracted before exponentiation for numerical stability.
+template<typename Scalar>
+void softmaxColumns(const Eigen::Ref<const MatrixX<Scalar>>& input, Eigen::Ref<MatrixX<Scalar>> output) {
+    for (Eigen::Index column = 0; column < input.cols(); ++column) {
+        output.col(column) = (input.col(column).array() - input.col(column).maxCoeff()).exp();
+        output.col(column) /= output.col(column).sum(); // Normalize to get probabilities.
+    }
+}
+
 // Softmax activation layer for output normalization.
-class SoftMax : public BaseLayer {
-    Eigen::VectorXd outputCache; // Cached output vector for use in backward pass.
+template<typename Scalar>
+class SoftMax : public BaseLayer<Scalar> {
+    using ConstRef = typename BaseLayer<Scalar>::ConstRef;
+    using MatrixRef = typename BaseLayer<Scalar>::MatrixRef;
 
 public:
-    // Performs the SoftMax operation on the input vector.
-    Eigen::VectorXd forward(const Eigen::VectorXd& input) override {
-        // Subtract max coefficient for numerical stability and compute exponential.
-        Eigen::VectorXd exp = (input.array() - input.maxCoeff()).exp();
-        outputCache = exp / exp.sum(); // Normalize to get probabilities.
-        return outputCache;
+    LayerType type() const override {
+        return LayerType::SoftMax;
+    }
+
+    // Performs the SoftMax operation on every column of the input batch.
+    void forward(const ConstRef& input, MatrixRef output, LayerState<Scalar>&) const override {
+        softmaxColumns<Scalar>(input, output);
     }
 
     // Computes gradient of SoftMax function during backward pass.
-    Eigen::VectorXd backward(const Eigen::VectorXd& gradient) override {
-        long dim = gradient.size();
-        Eigen::MatrixXd jacobian(dim, dim); // Jacobian matrix for SoftMax gradients.
-
-        // Compute the jacobian matrix of the SoftMax function.
-        for (int i = 0; i < dim; ++i) {
-            for (int j = 0; j < dim; ++j) {
-                // Derivative formula differs depending on if indices are equal or not.
-                jacobian(i, j) = i == j ? outputCache(i) * (1.0 - outputCache(j)) : -outputCache(i) * outputCache(j);
-            }
+    // For a sample with softmax output s the jacobian is J = diag(s) - s s^T, so the product with
+    // the gradient g is J g = s * (g - s.g), computed per column without forming J.
+    void backward(const ConstRef&, const ConstRef& output, const ConstRef& gradient,
+                  MatrixRef inputGradient, LayerState<Scalar>&) const override {
+        if (inputGradient.size() == 0) {
+            return;
+        }
+        for (Eigen::Index sample = 0; sample < gradient.cols(); ++sample) {
+            const Scalar projection = output.col(sample).dot(gradient.col(sample));
+            inputGradient.col(sample) = output.col(sample).cwiseProduct(
+                    (gradient.col(sample).array() - projection).matrix());
         }
-
-        // Multiply the gradient by the jacobian to get the gradient with respect to the input.
-        return jacobian * gradient;
     }
 };
@@ -1,41 +1,80 @@
 #pragma once
+#include "layers.hpp"
 #include <eigen3/Eigen/Dense>
 #include <cmath>
 #include <limits>
 
 // Class to compute CrossEntropyLoss, commonly used as a loss function for classification tasks.
+template<typename Scalar>
 class CrossEntropyLoss {
+    using Matrix = MatrixX<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
+    using MatrixRef = Eigen::Ref<Matrix>;
+
 public:
     // Default constructor.
     CrossEntropyLoss() = default;
 
     // Calculates the forward pass of the cross-entropy loss.
-    // This method computes the loss given the predictions and the target distributions.
-    static double forward(const Eigen::VectorXd& predictions, const Eigen::VectorXd& targets) {
-
-        // Ensure numerical stability by adding a small value to predictions to avoid log(0).
-        // std::numeric_limits<double>::epsilon() is used to get the smallest positive value such that 1.0 + epsilon != 1.0.
-        Eigen::VectorXd safe_predictions = predictions.array().max(std::numeric_limits<double>::epsilon());
+    // This method computes the mean loss over a batch given the predictions and the target distributions,
+    // both with one sample per column.
+    static Scalar forward(const ConstRef& predictions, const ConstRef& targets) {
 
-        // Compute the natural logarithm of the predictions.
-        // Logarithm of each element is taken to calculate the log likelihood.
-        Eigen::VectorXd log_predictions = safe_predictions.array().log();
+        // Ensure numerical stability by clamping predictions to a small value to avoid log(0).
+        // std::numeric_limits<Scalar>::epsilon() is used to get the smallest positive value such that 1 + epsilon != 1.
+        // The natural logarithm of each element is taken to calculate the log likelihood.
+        auto log_predictions = predictions.array().max(std::numeric_limits<Scalar>::epsilon()).log();
 
         // Calculate the negative log likelihood, which is the essence of cross-entropy loss.
         // This is achieved by element-wise multiplication of the targets with the log_predictions, followed by a sum and negation.
-        double loss = -(targets.array() * log_predictions.array()).sum();
+        // Dividing by the number of samples gives the mean over the batch.
+        Scalar loss = -(targets.array() * log_predictions).sum() / static_cast<Scalar>(targets.cols());
 
         return loss;
     }
 
-    // Calculates the gradient of the loss function with respect to the predictions.
+    // Calculates the gradient of the loss function with respect to the predictions into gradient.
     // This method is crucial for the backward pass in training neural networks.
-    static Eigen::VectorXd backward(const Eigen::VectorXd& predictions, const Eigen::VectorXd& targets) {
+    static void backward(const ConstRef& predictions, const ConstRef& targets, MatrixRef gradient) {
 
         // Compute the gradient of the cross-entropy loss with respect to the predictions.
         // This is done by dividing the negative targets by the predictions, ensuring numerical stability by avoiding division by zero.
-        Eigen::VectorXd gradient = -targets.array() / predictions.array().max(std::numeric_limits<double>::epsilon());
+        // The 1/batch factor of the mean loss is applied here once instead of in every layer.
+        gradient = -targets.array() / predictions.array().max(std::numeric_limits<Scalar>::epsilon())
+                   / static_cast<Scalar>(targets.cols());
+    }
+};
+
+
+// SoftMax followed by CrossEntropyLoss, fused into one output stage that works directly on the
+// logits of the last dense layer. The network must not end in a SoftMax layer when this is used.
+// Its backward pass avoids both the dim x dim SoftMax jacobian and the division by clamped predictions.
+template<typename Scalar>
+class SoftMaxCrossEntropyLoss {
+    using Matrix = MatrixX<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
+    using MatrixRef = Eigen::Ref<Matrix>;
+
+public:
+    // Default constructor.
+    SoftMaxCrossEntropyLoss() = default;
+
+    // Calculates the mean cross-entropy of softmax(logits) over the batch.
+    // Uses log(softmax(x)_i) = x_i - max(x) - log(sum_j exp(x_j - max(x))), so no log(0) can occur.
+    static Scalar forward(const ConstRef& logits, const ConstRef& targets) {
+        Scalar loss = 0;
+        for (Eigen::Index column = 0; column < logits.cols(); ++column) {
+            const Scalar maxLogit = logits.col(column).maxCoeff();
+            const Scalar logSumExp = std::log((logits.col(column).array() - maxLogit).exp().sum());
+            loss -= (targets.col(column).array() * (logits.col(column).array() - maxLogit - logSumExp)).sum();
+        }
+        return loss / static_cast<Scalar>(targets.cols());
+    }
 
-        return gradient;
+    // Calculates the gradient of the mean loss with respect to the logits into gradient, which is
+    // simply (softmax(logits) - targets) / batch.
+    static void backward(const ConstRef& logits, const ConstRef& targets, MatrixRef gradient) {
+        softmaxColumns<Scalar>(logits, gradient);
+        gradient = (gradient - targets) / static_cast<Scalar>(targets.cols());
     }
 };
@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <numbers>
+#include <string>
+
+// Shapes of the learning rate over the course of training.
+enum class ScheduleType {
+    Constant,
+    Step,
+    Cosine,
+    Plateau
+};
+
+inline const char* scheduleName(ScheduleType type) {
+    switch (type) {
+        case ScheduleType::Step:
+            return "step";
+        case ScheduleType::Cosine:
+            return "cosine";
+        case ScheduleType::Plateau:
+            return "plateau";
+        default:
+            return "constant";
+    }
+}
+
+// Parses "constant", "step", "cosine" or "plateau". Returns false for anything else.
+inline bool parseScheduleType(const std::string& name, ScheduleType& type) {
+    for (ScheduleType candidate : {ScheduleType::Constant, ScheduleType::Step, ScheduleType::Cosine, ScheduleType::Plateau}) {
+        if (name == scheduleName(candidate)) {
+            type = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct ScheduleSettings {
+    ScheduleType type = ScheduleType::Constant;
+    double warmupEpochs = 0.0;    // Linear ramp up to the scheduled rate at the start, for every schedule.
+    size_t stepEpochs = 10;       // Step: epochs between two decays.
+    double gamma = 0.1;           // Step and Plateau: factor applied per decay.
+    double minLearningRate = 0.0; // Cosine and Plateau: the rate never goes below this.
+    size_t plateauPatience = 2;   // Plateau: epochs without improvement before a decay.
+};
+
+// Learning rate as a function of training progress in fractional epochs, so it can change from
+// batch to batch. Step decays by gamma every stepEpochs epochs, Cosine anneals from the base rate
+// to the minimum over all epochs, and Plateau decays by gamma whenever the score reported through
+// observe has not improved for plateauPatience epochs.
+class LearningRateSchedule {
+private:
+    ScheduleSettings settings;
+    double baseRate = 0.0;
+    size_t totalEpochs = 1;
+    double batchEpochs = 0.0;  // Fraction of an epoch one batch covers.
+
+    // Plateau state
+    double plateauScale = 1.0;
+    double bestScore = -std::numeric_limits<double>::infinity();
+    size_t epochsWithoutImprovement = 0;
+
+public:
+    LearningRateSchedule() = default;
+
+    LearningRateSchedule(const ScheduleSettings& settings, double baseRate, size_t totalEpochs, double batchEpochs = 0.0)
+            : settings(settings), baseRate(baseRate), totalEpochs(std::max<size_t>(totalEpochs, 1)), batchEpochs(batchEpochs) {}
+
+    // Rate of the batch starting after progress epochs of training.
+    [[nodiscard]] double at(double progress) const {
+        double rate = baseRate;
+        switch (settings.type) {
+            case ScheduleType::Step:
+                rate *= std::pow(settings.gamma, std::floor(progress / static_cast<double>(std::max<size_t>(settings.stepEpochs, 1))));
+                break;
+            case ScheduleType::Cosine: {
+                const double fraction = std::min(progress / static_cast<double>(totalEpochs), 1.0);
+                rate = settings.minLearningRate
+                       + (baseRate - settings.minLearningRate) * 0.5 * (1.0 + std::cos(std::numbers::pi * fraction));
+                break;
+            }
+            case ScheduleType::Plateau:
+                rate = std::max(rate * plateauScale, settings.minLearningRate);
+                break;
+            default:
+                break;
+        }
+
+        // The warmup ramp counts the batch itself, so the first batch already makes a step and the
+        // last batch of the warmup reaches the scheduled rate
+        if (progress + batchEpochs < settings.warmupEpochs) {
+            rate *= (progress + batchEpochs) / settings.warmupEpochs;
+        }
+        return rate;
+    }
+
+    // Reports the score of a finished epoch, higher is better. Returns whether the plateau schedule
+    // decayed the rate because of it.
+    bool observe(double score) {
+        if (score > bestScore) {
+            bestScore = score;
+            epochsWithoutImprovement = 0;
+            return false;
+        }
+
+        if (settings.type != ScheduleType::Plateau || ++epochsWithoutImprovement < settings.plateauPatience) {
+            return false;
+        }
+        plateauScale *= settings.gamma;
+        epochsWithoutImprovement = 0;
+        return true;
+    }
+};
@@ -1,6 +1,13 @@
 #pragma once
 
 #include "tensor.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 template< typename ComponentType >
 class Vector
@@ -29,6 +36,11 @@ public:
     ComponentType&
     operator()(size_t idx);
 
+    // Contiguous storage of all elements.
+    const ComponentType* data() const;
+
+    ComponentType* data();
+
     // Reference to internal tensor.
     Tensor< ComponentType >& tensor();
 
@@ -66,6 +78,11 @@ public:
     ComponentType&
     operator()(size_t row, size_t col);
 
+    // Contiguous storage of all elements in row-major order.
+    const ComponentType* data() const;
+
+    ComponentType* data();
+
     // Reference to internal tensor.
     Tensor< ComponentType >& tensor();
 
@@ -107,7 +124,7 @@ template< typename ComponentType >
 const ComponentType&
 Vector< ComponentType >::operator()(size_t idx) const
 {
-    return tensor_({idx});
+    return tensor_(idx);
 }
 
 // Element mutation function
@@ -115,7 +132,19 @@ template< typename ComponentType >
 ComponentType&
 Vector< ComponentType >::operator()(size_t idx)
 {
-    return tensor_({idx});
+    return tensor_(idx);
+}
+
+template< typename ComponentType >
+const ComponentType* Vector< ComponentType >::data() const
+{
+    return tensor_.data();
+}
+
+template< typename ComponentType >
+ComponentType* Vector< ComponentType >::data()
+{
+    return tensor_.data();
 }
 
 template< typename ComponentType >
@@ -163,7 +192,7 @@ template< typename ComponentType >
 const ComponentType&
 Matrix< ComponentType >::operator()(size_t row, size_t col) const
 {
-    return tensor_({row, col});
+    return tensor_(row, col);
 }
 
 // Element mutation function
@@ -171,7 +200,19 @@ template< typename ComponentType >
 ComponentType&
 Matrix< ComponentType >::operator()(size_t row, size_t col)
 {
-    return tensor_({row, col});
+    return tensor_(row, col);
+}
+
+template< typename ComponentType >
+const ComponentType* Matrix< ComponentType >::data() const
+{
+    return tensor_.data();
+}
+
+template< typename ComponentType >
+ComponentType* Matrix< ComponentType >::data()
+{
+    return tensor_.data();
 }
 
 template< typename ComponentType >
@@ -181,6 +222,128 @@ Tensor< ComponentType >& Matrix< ComponentType >::tensor()
 }
 
 
+// Products with at least this many multiply-adds are split across OpenMP threads by rows.
+constexpr size_t PARALLEL_KERNEL_THRESHOLD = 1 << 18;
+
+// Block sizes of matmul: a KERNEL_BLOCK_INNER x KERNEL_BLOCK_COLS panel of the right matrix stays in
+// cache while KERNEL_BLOCK_ROWS rows of the result are accumulated from it.
+constexpr size_t KERNEL_BLOCK_ROWS = 64;
+constexpr size_t KERNEL_BLOCK_INNER = 128;
+constexpr size_t KERNEL_BLOCK_COLS = 256;
+
+// Calls body(i) for every i below count, split across OpenMP threads if work multiply-adds reach
+// PARALLEL_KERNEL_THRESHOLD. Otherwise, and inside a parallel region or with a single thread
+// available, the loop runs without entering OpenMP at all, since libgomp allocates a thread team
+// even for a parallel region that ends up with one thread.
+template< typename Body >
+void parallelFor(size_t count, size_t work, Body&& body)
+{
+#ifdef _OPENMP
+    if (work >= PARALLEL_KERNEL_THRESHOLD && omp_get_max_threads() > 1 && !omp_in_parallel())
+    {
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < count; i++)
+        {
+            body(i);
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++)
+    {
+        body(i);
+    }
+}
+
+// Computes out = mat * vec on raw row-major storage, one dot product per row.
+template< typename ComponentType >
+void matvec(const ComponentType* mat, const ComponentType* vec, ComponentType* out, size_t rows, size_t cols)
+{
+    parallelFor(rows, rows * cols, [&](size_t row)
+    {
+        out[row] = dot(mat + row * cols, vec, cols);
+    });
+}
+
+// Computes out = lhs * rhs on raw row-major storage (rows x inner times inner x cols). The loops
+// are blocked for cache reuse, and the innermost kernel accumulates a strip of an output row in
+// registers over the whole inner block of rhs.
+template< typename ComponentType >
+void matmul(const ComponentType* lhs, const ComponentType* rhs, ComponentType* out, size_t rows, size_t inner, size_t cols)
+{
+    std::fill(out, out + rows * cols, ComponentType(0));
+
+    const size_t rowBlocks = (rows + KERNEL_BLOCK_ROWS - 1) / KERNEL_BLOCK_ROWS;
+
+    parallelFor(rowBlocks, rows * inner * cols, [&](size_t rowBlock)
+    {
+        const size_t rowBegin = rowBlock * KERNEL_BLOCK_ROWS;
+        const size_t rowEnd = std::min(rowBegin + KERNEL_BLOCK_ROWS, rows);
+
+        for (size_t innerBegin = 0; innerBegin < inner; innerBegin += KERNEL_BLOCK_INNER)
+        {
+            const size_t innerEnd = std::min(innerBegin + KERNEL_BLOCK_INNER, inner);
+
+            for (size_t colBegin = 0; colBegin < cols; colBegin += KERNEL_BLOCK_COLS)
+            {
+                const size_t colCount = std::min(KERNEL_BLOCK_COLS, cols - colBegin);
+
+                for (size_t row = rowBegin; row < rowEnd; row++)
+                {
+                    gemmRow(lhs + row * inner + innerBegin, 1, rhs + innerBegin * cols + colBegin, cols,
+                            out + row * cols + colBegin, innerEnd - innerBegin, colCount);
+                }
+            }
+        }
+    });
+}
+
+// Computes out = lhs^T * rhs on raw row-major storage, with lhs stored as inner x rows and rhs as
+// inner x cols. Blocked like matmul, reading the transposed rows of lhs with a stride.
+template< typename ComponentType >
+void matmulTransposedLhs(const ComponentType* lhs, const ComponentType* rhs, ComponentType* out, size_t rows, size_t inner, size_t cols)
+{
+    std::fill(out, out + rows * cols, ComponentType(0));
+
+    const size_t rowBlocks = (rows + KERNEL_BLOCK_ROWS - 1) / KERNEL_BLOCK_ROWS;
+
+    parallelFor(rowBlocks, rows * inner * cols, [&](size_t rowBlock)
+    {
+        const size_t rowBegin = rowBlock * KERNEL_BLOCK_ROWS;
+        const size_t rowEnd = std::min(rowBegin + KERNEL_BLOCK_ROWS, rows);
+
+        for (size_t innerBegin = 0; innerBegin < inner; innerBegin += KERNEL_BLOCK_INNER)
+        {
+            const size_t innerEnd = std::min(innerBegin + KERNEL_BLOCK_INNER, inner);
+
+            for (size_t colBegin = 0; colBegin < cols; colBegin += KERNEL_BLOCK_COLS)
+            {
+                const size_t colCount = std::min(KERNEL_BLOCK_COLS, cols - colBegin);
+
+                for (size_t row = rowBegin; row < rowEnd; row++)
+                {
+                    gemmRow(lhs + innerBegin * rows + row, rows, rhs + innerBegin * cols + colBegin, cols,
+                            out + row * cols + colBegin, innerEnd - innerBegin, colCount);
+                }
+            }
+        }
+    });
+}
+
+// Computes out = lhs * rhs^T on raw row-major storage, with lhs stored as rows x inner and rhs as
+// cols x inner, so every element is the dot product of two contiguous rows.
+template< typename ComponentType >
+void matmulTransposedRhs(const ComponentType* lhs, const ComponentType* rhs, ComponentType* out, size_t rows, size_t inner, size_t cols)
+{
+    parallelFor(rows, rows * inner * cols, [&](size_t row)
+    {
+        for (size_t col = 0; col < cols; col++)
+        {
+            out[row * cols + col] = dot(lhs + row * inner, rhs + col * inner, inner);
+        }
+    });
+}
+
 // Performs a matrix-vector multiplication.
 template< typename ComponentType >
 Vector< ComponentType > matvec(const Matrix< ComponentType >& mat, const Vector< ComponentType >& vec)
@@ -192,14 +355,23 @@ Vector< ComponentType > matvec(const Matrix< ComponentType >& mat, const Vector<
     }
 
     Vector< ComponentType > out(mat.rows(), ComponentType(0));
+    matvec(mat.data(), vec.data(), out.data(), mat.rows(), mat.cols());
+
+    return out;
+}
+
+// Performs a matrix-matrix multiplication.
+template< typename ComponentType >
+Matrix< ComponentType > matmul(const Matrix< ComponentType >& lhs, const Matrix< ComponentType >& rhs)
+{
 
-    for (size_t row = 0; row < mat.rows(); row++)
+    if (lhs.cols() != rhs.rows())
     {
-        for (size_t col = 0; col < mat.cols(); col++)
-        {
-            out(row) += mat(row, col) * vec(col);
-        }
+        std::exit(1);
     }
 
+    Matrix< ComponentType > out(lhs.rows(), rhs.cols());
+    matmul(lhs.data(), rhs.data(), out.data(), lhs.rows(), lhs.cols(), rhs.cols());
+
     return out;
 }
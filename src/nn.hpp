@@ -1,149 +1,1044 @@
 #pragma once
 #include "layers.hpp"
 #include "loss.hpp"
+#include "data_loader/dataset.hpp"
+#include "data_loader/batch_prefetcher.hpp"
 #include <eigen3/Eigen/Dense>
-#include <ranges>
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <iostream>
 #include <numeric>
 #include "helpers.hpp"
+#include "allocation_counter.hpp"
+#include "prediction_log.hpp"
+#include "checkpoint.hpp"
+#include "static_mlp.hpp"
+#include "quantized.hpp"
+#include "optimizer.hpp"
+#include "lr_schedule.hpp"
+#include "profiler.hpp"
 #include <chrono>
+#include <iomanip>
 
+// Output stage of the network: a SoftMax layer followed by CrossEntropyLoss, or both fused into
+// SoftMaxCrossEntropyLoss operating on the logits.
+enum class OutputStage {
+    SoftMaxThenCrossEntropy,
+    FusedSoftMaxCrossEntropy
+};
+
+// How worker threads cooperate during training. Synchronous splits every batch across the workers
+// and applies one reduced update; Hogwild lets every worker update the shared parameters on its own
+// shard of the data without any locking.
+enum class TrainingMode {
+    Synchronous,
+    Hogwild
+};
+
+// Caller-owned buffers for passes through a network: the input batch, the outputs and gradients of
+// every layer and the loss gradient, all sized for batches of up to capacity samples and carved from
+// one arena. A pass only writes into its workspace, so threads with their own workspaces can share
+// one network, and once a workspace is prepared, passes of up to capacity samples perform no heap
+// allocations.
+template<typename Scalar>
+struct Workspace {
+    Arena arena;
+    MatrixMap<Scalar> images{nullptr, 0, 0}, labels{nullptr, 0, 0}; // Input batch and one-hot targets.
+    std::vector<LayerState<Scalar>> layers;                          // Per-layer outputs and gradients.
+    MatrixMap<Scalar> lossGradient{nullptr, 0, 0};                   // Gradient of the loss with respect to the network output.
+    Eigen::Index capacity = 0;
+    bool withGradients = false;
+};
+
+// Outcome of running the test set through a network. The confusion matrix counts samples by
+// actual label (row) and predicted label (column).
+struct EvaluationResult {
+    size_t correct = 0;
+    size_t total = 0;
+    Eigen::Matrix<size_t, Eigen::Dynamic, Eigen::Dynamic> confusion;
+    double seconds = 0.0;
+
+    [[nodiscard]] double accuracy() const {
+        return total > 0 ? static_cast<double>(correct) / static_cast<double>(total) * 100 : 0.0;
+    }
+};
+
+// Network and training loop, templated on the scalar type (float or double) of parameters,
+// activations and gradients.
+template<typename Scalar>
 class NeuralNetwork {
 private:
-    double learningRate;
-    std::vector <Eigen::VectorXd> trainingImageData, trainingLabelData, testingImageData, testingLabelData;
-    std::vector <std::shared_ptr<BaseLayer>> layers;
-    CrossEntropyLoss lossLayer;
+    using Matrix = MatrixX<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
+    using MatrixRef = Eigen::Ref<Matrix>;
+
+    Scalar learningRate;
+    int inputSize = 0, hiddenSize = 0, outputSize = 0;
+    std::shared_ptr<const Dataset<Scalar>> trainingData, testingData;
+    std::vector <std::shared_ptr<BaseLayer<Scalar>>> layers;
+    CrossEntropyLoss<Scalar> lossLayer;
+    SoftMaxCrossEntropyLoss<Scalar> fusedLossLayer;
+    OutputStage outputStage = OutputStage::FusedSoftMaxCrossEntropy;
+    ComputeBackend computeBackend = ComputeBackend::Eigen;
+    bool fusedReLU = false;
     std::vector<double> lossHistory;
 
+    // Profiler zones of the forward and backward call of every layer.
+    struct LayerZones {
+        uint32_t forward, backward;
+    };
+    std::vector<LayerZones> layerZones;
+
+    // Held-out tail of the training set that is evaluated after every epoch, null without a split.
+    std::shared_ptr<const Dataset<Scalar>> validationData;
+
+    // Learning rate over the epochs of train(), starting from learningRate, and the epoch in progress.
+    ScheduleSettings scheduleSettings;
+    LearningRateSchedule schedule;
+    size_t currentEpoch = 0;
+
+    // Number of epochs without a better validation accuracy after which train() stops, 0 for never.
+    size_t earlyStoppingPatience = 0;
+
+    // Order of the training samples, reshuffled every epoch if enabled. With prefetching, train()
+    // runs synchronous epochs on batches gathered ahead by a background thread.
+    bool shuffleSamples = false;
+    bool prefetchBatches = false;
+    uint64_t shuffleSeed = std::mt19937_64::default_seed;
+    std::mt19937_64 shuffleGenerator;
+    std::vector<size_t> sampleOrder;
+    std::unique_ptr<BatchPrefetcher<Scalar>> prefetcher;
+
+    // Update rule applied to the gradients of every batch.
+    OptimizerSettings optimizerSettings;
+    std::unique_ptr<Optimizer<Scalar>> optimizer = makeOptimizer<Scalar>(optimizerSettings);
+
+    // One workspace per worker thread, so workers never share activations or gradients.
+    size_t threadCount = 1;
+    TrainingMode trainingMode = TrainingMode::Synchronous;
+    std::vector<Workspace<Scalar>> workerWorkspaces;
+    std::vector<double> workerLosses;
+
+    // Current batch converted to floating point. Resident memory depends on the batch size and not
+    // on the dataset size, and the buffers are sized once for the largest batch.
+    Arena batchArena;
+    MatrixMap<Scalar> batchImages{nullptr, 0, 0}, batchLabels{nullptr, 0, 0};
+
+    // Test samples are pushed through the network in batches of this many columns, with the
+    // batches spread over one inference workspace per worker. Predicted and actual labels are
+    // collected per sample, so logging and the confusion matrix stay in dataset order.
+    static constexpr size_t evaluationBatchSize = 256;
+    std::vector<Workspace<Scalar>> evaluationWorkspaces;
+    std::vector<int> predictedLabels, actualLabels;
+
+    // Whether train() runs the test set after every epoch.
+    bool evaluateEveryEpoch = false;
+
+    // Whether the prediction log is written by a background thread.
+    bool backgroundLogging = false;
+
 public:
-    NeuralNetwork(double lr, const std::vector <std::vector<double>> &trainingImages,
-                  const std::vector <std::vector<double>> &trainingLabels,
-                  const std::vector <std::vector<double>> &tesingImages,
-                  const std::vector <std::vector<double>> &tesingLabels)
-            : learningRate(lr) {
+    NeuralNetwork(Scalar lr, std::shared_ptr<const Dataset<Scalar>> trainingSet, std::shared_ptr<const Dataset<Scalar>> testingSet)
+            : learningRate(lr), trainingData(std::move(trainingSet)), testingData(std::move(testingSet)),
+              schedule(scheduleSettings, lr, 1) {}
+
+    void setupLayers(int inputSize, int hiddenSize, int outputSize,
+                     OutputStage stage = OutputStage::FusedSoftMaxCrossEntropy,
+                     ComputeBackend backend = ComputeBackend::Eigen, bool fuseReLU = false) {
+        this->inputSize = inputSize;
+        this->hiddenSize = hiddenSize;
+        this->outputSize = outputSize;
+        this->outputStage = stage;
+        this->computeBackend = backend;
+        this->fusedReLU = fuseReLU;
+
+        // The hidden layer either carries the ReLU itself or is followed by a separate ReLU layer.
+        if (fuseReLU) {
+            layers.push_back(makeFullyConnectedLayer(inputSize, hiddenSize, true));
+        } else {
+            layers.push_back(makeFullyConnectedLayer(inputSize, hiddenSize, false));
+            layers.push_back(std::make_shared<ReLU<Scalar>>());
+        }
+        layers.push_back(makeFullyConnectedLayer(hiddenSize, outputSize, false));
+
+        // The fused stage applies the softmax inside the loss, so the network ends with the logits.
+        if (stage == OutputStage::SoftMaxThenCrossEntropy) {
+            layers.push_back(std::make_shared<SoftMax<Scalar>>());
+        }
+
+        // Profiler zones of the layer calls, e.g. "layer 0 FullyConnected forward"
+        layerZones.clear();
+        for (size_t i = 0; i < layers.size(); ++i) {
+            const std::string name = "layer " + std::to_string(i) + " " + layerTypeName(layers[i]->type());
+            layerZones.push_back({Profiler::instance().zone(name + " forward"), Profiler::instance().zone(name + " backward")});
+        }
+    }
+
+    // Dense layer, optionally with a fused ReLU, running on the configured compute backend.
+    std::shared_ptr<BaseLayer<Scalar>> makeFullyConnectedLayer(int inputSize, int outputSize, bool withReLU) const {
+        if (computeBackend == ComputeBackend::Native) {
+            return makeFullyConnectedLayer<NativeBackend<Scalar>>(inputSize, outputSize, withReLU);
+        }
+        return makeFullyConnectedLayer<EigenBackend<Scalar>>(inputSize, outputSize, withReLU);
+    }
+
+    template<typename Backend>
+    static std::shared_ptr<BaseLayer<Scalar>> makeFullyConnectedLayer(int inputSize, int outputSize, bool withReLU) {
+        if (withReLU) {
+            return std::make_shared<FullyConnectedReLULayer<Scalar, Backend>>(inputSize, outputSize);
+        }
+        return std::make_shared<FullyConnectedLayer<Scalar, Backend>>(inputSize, outputSize);
+    }
+
+    // Number of worker threads a batch is split across during training.
+    void setThreadCount(size_t threads) {
+        threadCount = std::max<size_t>(threads, 1);
+        workerWorkspaces.resize(threadCount);
+    }
+
+    [[nodiscard]] size_t getThreadCount() const {
+        return threadCount;
+    }
+
+    void setTrainingMode(TrainingMode mode) {
+        trainingMode = mode;
+    }
+
+    // Replaces the optimizer, dropping any optimizer state.
+    void setOptimizer(const OptimizerSettings& settings) {
+        optimizerSettings = settings;
+        optimizer = makeOptimizer<Scalar>(settings);
+    }
+
+    // Holds out the last fraction of the training samples as a validation set. Training then only
+    // uses the samples before it.
+    void setValidationSplit(double fraction) {
+        const size_t total = trainingData->size();
+        const auto held = static_cast<size_t>(static_cast<double>(total) * fraction);
+        if (held == 0 || held >= total) {
+            return;
+        }
+
+        validationData = std::make_shared<DatasetSlice<Scalar>>(trainingData, total - held, held);
+        trainingData = std::make_shared<DatasetSlice<Scalar>>(trainingData, 0, total - held);
+    }
+
+    void setLearningRateSchedule(const ScheduleSettings& settings) {
+        scheduleSettings = settings;
+    }
+
+    // Stops training after patience epochs without a better validation accuracy and keeps the
+    // parameters of the best epoch. Needs a validation split.
+    void setEarlyStoppingPatience(size_t patience) {
+        earlyStoppingPatience = patience;
+    }
+
+    // Shuffles the training samples every epoch, starting from the given seed, and gathers the
+    // batches of synchronous training on a background thread if prefetch is set.
+    void setDataPipeline(bool shuffle, bool prefetch, uint64_t seed) {
+        shuffleSamples = shuffle;
+        prefetchBatches = prefetch;
+        shuffleSeed = seed;
+        shuffleGenerator.seed(seed);
+    }
+
+    void setBackgroundLogging(bool enabled) {
+        backgroundLogging = enabled;
+    }
+
+    void setEvaluateEveryEpoch(bool enabled) {
+        evaluateEveryEpoch = enabled;
+    }
+
+    // Writes the parameters of all layers to a binary checkpoint and returns its size in bytes.
+    size_t saveCheckpoint(const std::string& path) const {
+        return ::saveCheckpoint<Scalar>(path, layers);
+    }
+
+    // Restores the parameters of all layers from a checkpoint of a network with the same layers.
+    void loadCheckpoint(const std::string& path) {
+        ::loadCheckpoint<Scalar>(path, layers);
+    }
 
-        // Convert the input data to Eigen::VectorXd because we did not do it in the data loader
-        // TODO: This is not efficient, we should convert the data to Eigen::VectorXd in the data loader
-        for (const auto &vec: trainingImages) {
-            trainingImageData.emplace_back(Eigen::Map<const Eigen::VectorXd>(vec.data(), vec.size()));
+    // Sizes a workspace for batches of up to batchColumns samples. Gradient buffers are only
+    // allocated for training. Does nothing if the workspace is already large enough, so it is cheap
+    // to call before every pass.
+    void prepareWorkspace(Workspace<Scalar>& workspace, Eigen::Index batchColumns, bool withGradients) const {
+        if (workspace.capacity >= batchColumns && workspace.layers.size() == layers.size()
+            && (workspace.withGradients || !withGradients)) {
+            return;
         }
-        for (const auto &vec: trainingLabels) {
-            trainingLabelData.emplace_back(Eigen::Map<const Eigen::VectorXd>(vec.data(), vec.size()));
+
+        // A workspace that was used for training keeps its gradient buffers.
+        withGradients = withGradients || workspace.withGradients;
+        batchColumns = std::max(batchColumns, workspace.capacity);
+
+        workspace.layers.resize(layers.size());
+
+        // Lay out all buffers twice, first to size the arena and then to bind them to its storage
+        for (bool sizing : {true, false}) {
+            if (sizing) {
+                workspace.arena.beginSizing();
+            } else {
+                workspace.arena.commit();
+            }
+
+            workspace.arena.bind(workspace.images, inputSize, batchColumns);
+            workspace.arena.bind(workspace.labels, outputSize, batchColumns);
+
+            Eigen::Index rows = inputSize;
+            for (size_t i = 0; i < layers.size(); ++i) {
+                // The input gradient of the first layer would only be thrown away.
+                layers[i]->prepare(workspace.layers[i], workspace.arena, rows, batchColumns, withGradients, i > 0);
+                rows = layers[i]->outputRows(rows);
+            }
+
+            workspace.arena.bind(workspace.lossGradient, withGradients ? rows : 0, batchColumns);
+        }
+
+        workspace.capacity = batchColumns;
+        workspace.withGradients = withGradients;
+    }
+
+    // Forward pass through all layers, every layer writing its output into the workspace.
+    // The workspace must be prepared for at least input.cols() samples. Returns a view of the
+    // network output inside the workspace.
+    ConstRef forwardPass(const ConstRef &input, Workspace<Scalar> &workspace) const {
+        NN_PROFILE_SCOPE("forward pass");
+        const auto columns = input.cols();
+        for (size_t i = 0; i < layers.size(); ++i) {
+            NN_PROFILE_ZONE(layerZones[i].forward);
+            ConstRef layerInput = i == 0 ? input : ConstRef(workspace.layers[i - 1].output.leftCols(columns));
+            layers[i]->forward(layerInput, workspace.layers[i].output.leftCols(columns), workspace.layers[i]);
+        }
+        return workspace.layers.back().output.leftCols(columns);
+    }
+
+    // Backward pass from the loss gradient in the workspace, leaving the parameter gradients in the
+    // layer states of the workspace. input must be the input of the preceding forwardPass.
+    void backwardPass(const ConstRef &input, Workspace<Scalar> &workspace) const {
+        NN_PROFILE_SCOPE("backward pass");
+        const auto columns = input.cols();
+        for (size_t i = layers.size(); i-- > 0;) {
+            NN_PROFILE_ZONE(layerZones[i].backward);
+            ConstRef layerInput = i == 0 ? input : ConstRef(workspace.layers[i - 1].output.leftCols(columns));
+            ConstRef gradient = i + 1 == layers.size() ? ConstRef(workspace.lossGradient.leftCols(columns))
+                                                       : ConstRef(workspace.layers[i + 1].inputGradient.leftCols(columns));
+            LayerState<Scalar>& state = workspace.layers[i];
+            layers[i]->backward(layerInput, state.output.leftCols(columns), gradient,
+                                state.inputGradient.leftCols(columns), state);
+        }
+    }
+
+    // Inference on a batch with a caller-owned workspace. Only reads the network, so any number of
+    // threads may call it concurrently as long as every thread uses its own workspace.
+    ConstRef predict(const ConstRef &input, Workspace<Scalar> &workspace) const {
+        prepareWorkspace(workspace, input.cols(), false);
+        return forwardPass(input, workspace);
+    }
+
+    // Computes the mean loss of a batch and writes its gradient with respect to the network output.
+    Scalar lossAndGradient(const ConstRef &predictions, const ConstRef &targets, MatrixRef gradient) const {
+        NN_PROFILE_SCOPE("loss");
+        if (outputStage == OutputStage::FusedSoftMaxCrossEntropy) {
+            fusedLossLayer.backward(predictions, targets, gradient);
+            return fusedLossLayer.forward(predictions, targets);
+        }
+        lossLayer.backward(predictions, targets, gradient);
+        return lossLayer.forward(predictions, targets);
+    }
+
+    // Runs task(worker) for workers = 0 .. count - 1, one OpenMP thread each. A single worker runs on
+    // the calling thread, since OpenMP allocates a fresh thread team for every single-threaded region.
+    template<typename Task>
+    void forEachWorker(Eigen::Index count, Task&& task) {
+        if (count == 1) {
+            task(0);
+            return;
+        }
+
+        #pragma omp parallel for num_threads(count) schedule(static, 1)
+        for (Eigen::Index worker = 0; worker < count; ++worker) {
+            task(worker);
+        }
+    }
+
+    // Trains on one batch. The columns are split evenly across the worker threads, and every worker
+    // runs forward and backward on its share in its own workspace. The per-worker gradients are
+    // then summed with a tree reduction and applied in a single update with the given learning
+    // rate. The workspaces must be reserved for the batch size by reserveBatches. Returns the batch
+    // loss.
+    double trainBatch(const ConstRef &images, const ConstRef &labels, Scalar rate) {
+        NN_PROFILE_SCOPE("train batch");
+        const auto batchColumns = images.cols();
+        const auto share = (batchColumns + static_cast<Eigen::Index>(threadCount) - 1) / static_cast<Eigen::Index>(threadCount);
+        const auto workers = (batchColumns + share - 1) / share;
+
+        workerLosses.assign(workers, 0.0);
+
+        // Every parallel region of a batch uses a team of threadCount threads, also when a short
+        // batch needs fewer workers, since OpenMP rebuilds its thread team, allocating, whenever
+        // the team size changes. Surplus threads return right away. A batch for a single worker,
+        // such as one sample, runs on the calling thread without entering a parallel region.
+        const auto team = workers == 1 ? Eigen::Index(1) : static_cast<Eigen::Index>(threadCount);
+        forEachWorker(team, [&](Eigen::Index worker) {
+            if (worker >= workers) {
+                return;
+            }
+            const auto first = worker * share;
+            const auto columns = std::min(share, batchColumns - first);
+            Workspace<Scalar>& workspace = workerWorkspaces[worker];
+
+            // Forward pass
+            ConstRef input = images.middleCols(first, columns);
+            ConstRef predictions = forwardPass(input, workspace);
+
+            // Compute loss; the loss layers average over the share, rescale to the whole batch
+            auto error = workspace.lossGradient.leftCols(columns);
+            const Scalar weight = static_cast<Scalar>(columns) / static_cast<Scalar>(batchColumns);
+            workerLosses[worker] = lossAndGradient(predictions, labels.middleCols(first, columns), error) * weight;
+            error *= weight;
+
+            // Backward pass
+            backwardPass(input, workspace);
+        });
+
+        // Tree reduction: after the pass with a given stride, worker w holds the sum of workers
+        // [w, w + 2 * stride), so worker 0 ends up with the gradient of the whole batch.
+        {
+            NN_PROFILE_SCOPE("gradient reduction");
+            for (Eigen::Index stride = 1; stride < workers; stride *= 2) {
+                forEachWorker(team, [&](Eigen::Index worker) {
+                    if (worker % (2 * stride) != 0 || worker + stride >= workers) {
+                        return;
+                    }
+                    for (size_t i = 0; i < layers.size(); ++i) {
+                        workerWorkspaces[worker].layers[i].accumulate(workerWorkspaces[worker + stride].layers[i]);
+                    }
+                });
+            }
         }
 
-        for (const auto &vec: tesingImages) {
-            testingImageData.emplace_back(Eigen::Map<const Eigen::VectorXd>(vec.data(), vec.size()));
+        // Single parameter update per batch
+        {
+            NN_PROFILE_SCOPE("optimizer step");
+            optimizer->step(layers, workerWorkspaces.front().layers, rate);
         }
 
-        for (const auto &vec: tesingLabels) {
-            testingLabelData.emplace_back(Eigen::Map<const Eigen::VectorXd>(vec.data(), vec.size()));
+        return std::accumulate(workerLosses.begin(), workerLosses.end(), 0.0);
+    }
+
+    // Asynchronous lock-free training in the style of Hogwild. The samples are cut into one contiguous
+    // shard per worker, and every worker runs mini-batch SGD on its shard in its own workspace,
+    // writing its updates straight into the shared parameters. Updates of different workers may
+    // interleave; plain SGD only writes parameters with non-zero gradients to keep such conflicts
+    // rare, and the state of the other optimizers is shared the same lock-free way. Every worker
+    // follows the learning rate schedule by its progress through its own shard. Returns the mean
+    // loss over all samples.
+    double trainEpochHogwild(size_t batchSize, size_t sampleCount) {
+        if (sampleCount == 0) {
+            return 0.0;
+        }
+
+        const size_t workers = std::min(threadCount, sampleCount);
+        const size_t shard = (sampleCount + workers - 1) / workers;
+
+        workerLosses.assign(workers, 0.0);
+
+        forEachWorker(static_cast<Eigen::Index>(workers), [&](Eigen::Index worker) {
+            const size_t begin = worker * shard;
+            const size_t end = std::min(begin + shard, sampleCount);
+            Workspace<Scalar>& workspace = workerWorkspaces[worker];
+            prepareWorkspace(workspace, static_cast<Eigen::Index>(batchSize), true);
+
+            for (size_t first = begin; first < end; first += batchSize) {
+                const auto columns = static_cast<Eigen::Index>(std::min(batchSize, end - first));
+                auto images = workspace.images.leftCols(columns);
+                auto labels = workspace.labels.leftCols(columns);
+                gatherTrainingBatch(first, columns, images, labels);
+
+                ConstRef predictions = forwardPass(images, workspace);
+                workerLosses[worker] += lossAndGradient(predictions, labels, workspace.lossGradient.leftCols(columns)) * columns;
+                backwardPass(images, workspace);
+
+                // Rate at the start of the batch in the shard
+                const double progress = static_cast<double>(first - begin) / static_cast<double>(end - begin);
+                NN_PROFILE_SCOPE("optimizer step");
+                optimizer->step(layers, workspace.layers, static_cast<Scalar>(schedule.at(currentEpoch + progress)), true);
+            }
+        });
+
+        return std::accumulate(workerLosses.begin(), workerLosses.end(), 0.0) / static_cast<double>(sampleCount);
+    }
+
+    // Sizes the batch buffers and the workspaces of all workers for batches of up to batchSize
+    // samples, so that training steps afterwards do not allocate.
+    void reserveBatches(size_t batchSize) {
+        const auto columns = static_cast<Eigen::Index>(batchSize);
+        if (batchImages.cols() < columns) {
+            for (bool sizing : {true, false}) {
+                if (sizing) {
+                    batchArena.beginSizing();
+                } else {
+                    batchArena.commit();
+                }
+                batchArena.bind(batchImages, inputSize, columns);
+                batchArena.bind(batchLabels, outputSize, columns);
+            }
+        }
+
+        // The synchronous trainer gives every worker its share of a batch, Hogwild a whole batch
+        const auto threads = static_cast<Eigen::Index>(threadCount);
+        const auto share = trainingMode == TrainingMode::Hogwild ? columns : (columns + threads - 1) / threads;
+        for (auto& workspace : workerWorkspaces) {
+            prepareWorkspace(workspace, share, true);
+        }
+        workerLosses.reserve(threadCount);
+        optimizer->prepare(layers);
+
+        if (sampleOrder.size() != trainingData->size()) {
+            sampleOrder.resize(trainingData->size());
+            std::iota(sampleOrder.begin(), sampleOrder.end(), size_t(0));
         }
     }
 
-    void setupLayers(int inputSize, int hiddenSize, int outputSize) {
-        layers.push_back(std::make_shared<FullyConnectedLayer>(inputSize, hiddenSize, learningRate));
-        layers.push_back(std::make_shared<ReLU>());
-        layers.push_back(std::make_shared<FullyConnectedLayer>(hiddenSize, outputSize, learningRate));
-        layers.push_back(std::make_shared<SoftMax>());
+    // Gathers the training samples [first, first + columns) of the current epoch's order.
+    void gatherTrainingBatch(size_t first, Eigen::Index columns, MatrixRef images, MatrixRef labels) const {
+        NN_PROFILE_SCOPE("gather batch");
+        if (shuffleSamples) {
+            trainingData->gather(std::span<const size_t>(sampleOrder).subspan(first, static_cast<size_t>(columns)), images, labels);
+        } else {
+            trainingData->gather(first, columns, images, labels);
+        }
     }
 
-    Eigen::VectorXd forwardPass(const Eigen::VectorXd &input) {
-        Eigen::VectorXd output = input;
-        for (const auto &layer: layers) {
-            output = layer->forward(output);
+    // Runs one synchronous epoch on the batches of the prefetcher. Returns the mean loss over the
+    // samples.
+    double trainEpochPrefetched() {
+        const size_t sampleCount = trainingData->size();
+        double lossSum = 0.0;
+        size_t done = 0;
+        for (size_t batch = 0; batch < prefetcher->batchesPerEpoch(); ++batch) {
+            const auto& prefetched = prefetcher->acquire();
+
+            const double progress = static_cast<double>(done) / static_cast<double>(sampleCount);
+            const auto rate = static_cast<Scalar>(schedule.at(currentEpoch + progress));
+            lossSum += trainBatch(prefetched.images.leftCols(prefetched.columns),
+                                  prefetched.labels.leftCols(prefetched.columns), rate) * prefetched.columns;
+            done += static_cast<size_t>(prefetched.columns);
+            prefetcher->release();
         }
-        return output;
+        optimizer->flush();
+        return lossSum / static_cast<double>(sampleCount);
     }
 
-    void backwardPass(const Eigen::VectorXd &gradient) {
-        Eigen::VectorXd error = gradient;
-        for (auto & layer : std::ranges::reverse_view(layers)) {
-            error = layer->backward(error);
+    // Runs one pass of mini-batch training over the first sampleCount training samples, with the
+    // learning rate following the schedule through the current epoch. Returns the mean loss over
+    // the samples.
+    double trainEpoch(size_t batchSize, size_t sampleCount) {
+        reserveBatches(batchSize);
+
+        if (prefetcher && trainingMode == TrainingMode::Synchronous && sampleCount == trainingData->size()) {
+            return trainEpochPrefetched();
+        }
+
+        if (shuffleSamples) {
+            std::shuffle(sampleOrder.begin(), sampleOrder.end(), shuffleGenerator);
+        }
+
+        if (trainingMode == TrainingMode::Hogwild) {
+            return trainEpochHogwild(batchSize, sampleCount);
+        }
+
+        double lossSum = 0.0;
+        for (size_t first = 0; first < sampleCount; first += batchSize) {
+            const auto columns = static_cast<Eigen::Index>(std::min(batchSize, sampleCount - first));
+            gatherTrainingBatch(first, columns, batchImages.leftCols(columns), batchLabels.leftCols(columns));
+
+            // The rate at the start of the batch, so a step decay begins with the first batch after it
+            const double progress = static_cast<double>(first) / static_cast<double>(sampleCount);
+            const auto rate = static_cast<Scalar>(schedule.at(currentEpoch + progress));
+            lossSum += trainBatch(batchImages.leftCols(columns), batchLabels.leftCols(columns), rate) * columns;
         }
+
+        // Batches that did not fill a whole accumulation window still update the parameters
+        optimizer->flush();
+        return lossSum / static_cast<double>(sampleCount);
     }
 
-    void train(size_t epochs) {
+    void train(size_t epochs, size_t batchSize) {
         auto timerStart = std::chrono::high_resolution_clock::now();
 
-        Eigen::setNbThreads(4); // Use 4 threads for Eigen operations
+        // Parallelism comes from splitting batches across workers, so Eigen itself runs single threaded
+        // inside every worker instead of oversubscribing the cores.
+        Eigen::setNbThreads(1);
+
+        // Lay out every buffer before the first step, the epochs below then run allocation free
+        reserveBatches(batchSize);
+
+        std::cout << "Training with " << threadCount << (trainingMode == TrainingMode::Hogwild ? " Hogwild" : "")
+                  << " threads and batch size " << batchSize << ", optimizer " << optimizerName(optimizerSettings.type)
+                  << "." << std::endl;
+
+        schedule = LearningRateSchedule(scheduleSettings, learningRate, epochs,
+                                        static_cast<double>(batchSize) / static_cast<double>(std::max<size_t>(trainingData->size(), 1)));
+        lossHistory.clear();
+
+        // The prefetcher works through all epochs up front and is stopped when training ends
+        if (prefetchBatches && trainingMode == TrainingMode::Synchronous) {
+            prefetcher = std::make_unique<BatchPrefetcher<Scalar>>(trainingData, batchSize, epochs, shuffleSamples, shuffleSeed);
+        }
+
+        // Parameters of the epoch with the best validation accuracy, kept for early stopping
+        const bool validationStopping = validationData && earlyStoppingPatience > 0;
+        std::vector<Matrix> bestParameters;
+        double bestAccuracy = -1.0;
+        size_t bestEpoch = 0;
 
-        std::cout << "Training with " << Eigen::nbThreads() << " threads." << std::endl;
+        // The per-epoch profiles start with the first epoch
+        Profiler::instance().takeTotals();
 
-        double loss;
         for (size_t epoch = 0; epoch < epochs; ++epoch) {
-            // Clear loss history for this epoch
-            lossHistory.clear();
+            currentEpoch = epoch;
 
-            // Run for every image in the dataset
-            for (size_t datasetIndex = 0; datasetIndex < trainingImageData.size(); ++datasetIndex) {
+            auto epochStart = std::chrono::steady_clock::now();
+            AllocationStats allocationsBefore = allocationStats();
+            double loss = trainEpoch(batchSize, trainingData->size());
+            AllocationStats epochAllocations = allocationStats() - allocationsBefore;
+            double epochSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - epochStart).count();
 
-                // Forward pass
-                Eigen::VectorXd prediction_tensor = forwardPass(trainingImageData[datasetIndex]);
+            // Store the mean loss over the samples of this epoch
+            lossHistory.push_back(loss);
 
-                // Compute loss
-                loss = lossLayer.forward(prediction_tensor, trainingLabelData[datasetIndex]);
+            std::cout << "Epoch " << epoch + 1 << ", Average Loss: " << loss << ", "
+                      << trainingData->size() / epochSeconds << " samples/s, " << epochAllocations.count
+                      << " allocations (" << epochAllocations.bytes << " bytes)" << std::endl;
 
-                // Backward pass
-                Eigen::VectorXd error = lossLayer.backward(prediction_tensor, trainingLabelData[datasetIndex]);
+            if (prefetcher) {
+                std::cout << "Epoch " << epoch + 1 << ", waited " << prefetcher->takeStallSeconds()
+                          << " s for prefetched batches" << std::endl;
+            }
 
-                backwardPass(error);
+            if (scheduleSettings.type != ScheduleType::Constant || scheduleSettings.warmupEpochs > 0) {
+                // The rate of the first batch of the epoch
+                std::cout << "Epoch " << epoch + 1 << ", Learning Rate: " << schedule.at(static_cast<double>(epoch))
+                          << std::endl;
             }
 
-            // Store loss for this epoch
-            lossHistory.push_back(loss);
+            // Score of the epoch for the plateau schedule: validation accuracy, or the negated
+            // training loss without a validation set
+            double score = -loss;
+            if (validationData) {
+                EvaluationResult validation = evaluate(*validationData, "");
+                score = validation.accuracy();
+                std::cout << "Epoch " << epoch + 1 << ", Validation Accuracy: " << score << "%" << std::endl;
+            }
+            if (schedule.observe(score)) {
+                std::cout << "Epoch " << epoch + 1 << ", no improvement for " << scheduleSettings.plateauPatience
+                          << " epochs, learning rate reduced" << std::endl;
+            }
+
+            if (evaluateEveryEpoch) {
+                EvaluationResult result = evaluate("");
+                std::cout << "Epoch " << epoch + 1 << ", Test Accuracy: " << result.accuracy() << "% in "
+                          << result.seconds << " s" << std::endl;
+            }
 
-            // Compute average loss for the epoch
-            double avgLoss = std::accumulate(lossHistory.begin(), lossHistory.end(), 0.0) / lossHistory.size();
+            if (Profiler::instance().enabled()) {
+                printProfile(epoch, std::chrono::duration<double>(std::chrono::steady_clock::now() - epochStart).count());
+            }
 
-            std::cout << "Epoch " << epoch + 1 << ", Average Loss: " << avgLoss << std::endl;
+            // Early stopping on validation accuracy
+            if (validationStopping) {
+                if (score > bestAccuracy) {
+                    bestAccuracy = score;
+                    bestEpoch = epoch;
+                    copyParameters(bestParameters);
+                } else if (epoch - bestEpoch >= earlyStoppingPatience) {
+                    std::cout << "Early stopping at epoch " << epoch + 1 << ", no better validation accuracy for "
+                              << earlyStoppingPatience << " epochs" << std::endl;
+                    break;
+                }
+            }
 
-            // early stopping
-            if (avgLoss < 0.0001) {
+            // Early stopping on a vanishing training loss, unless the validation accuracy decides
+            if (!validationStopping && loss < 0.0001) {
                 std::cout << "Early stopping at epoch " << epoch + 1 << std::endl;
                 break;
             }
         }
 
+        prefetcher.reset();
+
+        if (!bestParameters.empty() && bestEpoch + 1 != lossHistory.size()) {
+            restoreParameters(bestParameters);
+            std::cout << "Restored the parameters of epoch " << bestEpoch + 1 << " (" << bestAccuracy
+                      << "% validation accuracy)" << std::endl;
+        }
+
         // Stop timer and calculate duration
         auto timerStop = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(timerStop - timerStart).count();
+        double duration = std::chrono::duration<double>(timerStop - timerStart).count();
 
         std::cout << "Training took " << duration << " seconds." << std::endl;
     }
 
-    void test(const std::string& filename) {
-        // Total of correct predictions and incorrect predictions
-        int correct = 0;
-        int incorrect = 0;
+    // Prints the time of every profiler zone since the last profile. Times are summed over all
+    // threads and zones nest, e.g. the layer calls inside the passes, so the shares of the wall time
+    // do not add up to 100%.
+    void printProfile(size_t epoch, double wallSeconds) const {
+        std::vector<Profiler::ZoneTotal> totals = Profiler::instance().takeTotals();
 
-        for (int datasetIndex = 0; datasetIndex < testingImageData.size(); datasetIndex++) {
+        std::cout << "Epoch " << epoch + 1 << " profile, " << wallSeconds << " s wall:" << std::endl;
+        std::cout << std::setw(36) << "zone" << std::setw(10) << "calls" << std::setw(12) << "total ms"
+                  << std::setw(10) << "% wall" << std::setw(12) << "mean us" << std::endl;
+        for (const Profiler::ZoneTotal& total : totals) {
+            std::cout << std::setw(36) << total.name << std::setw(10) << total.calls << std::fixed << std::setprecision(2)
+                      << std::setw(12) << total.seconds * 1e3 << std::setw(10) << 100.0 * total.seconds / wallSeconds
+                      << std::setw(12) << total.seconds * 1e6 / static_cast<double>(total.calls) << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+        }
+    }
 
-            // Forward pass
-            Eigen::VectorXd output = forwardPass(testingImageData[datasetIndex]);
+    // Copies all parameter blocks into snapshot, reusing its matrices once they are sized.
+    void copyParameters(std::vector<Matrix>& snapshot) const {
+        size_t index = 0;
+        for (const auto& layer : layers) {
+            const std::shared_ptr<const BaseLayer<Scalar>> constLayer = layer;
+            for (const auto& block : constLayer->parameters()) {
+                if (index == snapshot.size()) {
+                    snapshot.emplace_back();
+                }
+                snapshot[index++] = block;
+            }
+        }
+    }
+
+    // Writes a snapshot taken by copyParameters back into the layers.
+    void restoreParameters(const std::vector<Matrix>& snapshot) {
+        size_t index = 0;
+        for (const auto& layer : layers) {
+            for (auto& block : layer->parameters()) {
+                block = snapshot[index++];
+            }
+        }
+    }
+
+    // Measures training throughput for every combination of batch size and thread count on freshly
+    // initialized copies of the network, so the weights of this network are left untouched, and
+    // prints the results as a table. Speedups are relative to the first row.
+    void benchmarkThroughput(const std::vector<size_t>& batchSizes, const std::vector<size_t>& threadCounts,
+                             size_t sampleCount) const {
+        sampleCount = std::min(sampleCount, trainingData->size());
+        if (sampleCount == 0 || batchSizes.empty() || threadCounts.empty()) {
+            return;
+        }
+
+        Eigen::setNbThreads(1);
+
+        std::cout << "Throughput over " << sampleCount << " training samples:" << std::endl;
+        std::cout << std::setw(12) << "batch size" << std::setw(10) << "threads" << std::setw(16) << "samples/s"
+                  << std::setw(12) << "speedup" << std::endl;
+
+        double baseline = 0.0;
+        for (size_t batchSize : batchSizes) {
+            for (size_t threads : threadCounts) {
+                NeuralNetwork scratch(learningRate, trainingData, testingData);
+                scratch.setupLayers(inputSize, hiddenSize, outputSize, outputStage, computeBackend, fusedReLU);
+                scratch.setOptimizer(optimizerSettings);
+                scratch.setThreadCount(threads);
+
+                auto start = std::chrono::steady_clock::now();
+                scratch.trainEpoch(batchSize, sampleCount);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                double samplesPerSecond = static_cast<double>(sampleCount) / seconds;
+                if (baseline == 0.0) {
+                    baseline = samplesPerSecond;
+                }
+
+                std::cout << std::setw(12) << batchSize << std::setw(10) << threads << std::setw(16) << std::fixed
+                          << std::setprecision(1) << samplesPerSecond << std::setw(11) << samplesPerSecond / baseline
+                          << "x" << std::endl;
+                std::cout.unsetf(std::ios::floatfield);
+                std::cout << std::setprecision(6);
+            }
+        }
+    }
+
+    // Trains one pass over sampleCount samples with the synchronous and with the Hogwild trainer,
+    // both starting from fresh networks with the current thread count, and prints throughput next to
+    // the resulting loss and test accuracy, so the speed gained can be weighed against convergence.
+    void compareTrainingModes(size_t batchSize, size_t sampleCount) const {
+        sampleCount = std::min(sampleCount, trainingData->size());
+        if (sampleCount == 0) {
+            return;
+        }
+
+        Eigen::setNbThreads(1);
+
+        std::cout << "Synchronous vs. Hogwild over " << sampleCount << " training samples, " << threadCount
+                  << " threads, batch size " << batchSize << ":" << std::endl;
+        std::cout << std::setw(12) << "trainer" << std::setw(16) << "samples/s" << std::setw(12) << "loss"
+                  << std::setw(12) << "accuracy" << std::endl;
+
+        for (TrainingMode mode : {TrainingMode::Synchronous, TrainingMode::Hogwild}) {
+            NeuralNetwork scratch(learningRate, trainingData, testingData);
+            scratch.setupLayers(inputSize, hiddenSize, outputSize, outputStage, computeBackend, fusedReLU);
+            scratch.setOptimizer(optimizerSettings);
+            scratch.setThreadCount(threadCount);
+            scratch.setTrainingMode(mode);
+
+            auto start = std::chrono::steady_clock::now();
+            double loss = scratch.trainEpoch(batchSize, sampleCount);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            double accuracy = scratch.evaluate("").accuracy();
 
-            // Get the index of the maximum element in the output vector
-            int predictionLabel;
-            output.maxCoeff(&predictionLabel);
+            std::cout << std::setw(12) << (mode == TrainingMode::Hogwild ? "hogwild" : "sync") << std::setw(16)
+                      << std::fixed << std::setprecision(1) << sampleCount / seconds << std::setw(12)
+                      << std::setprecision(4) << loss << std::setw(11) << std::setprecision(2) << accuracy << "%"
+                      << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+        }
+    }
+
+    // Measures single-image inference latency over the first sampleCount test samples, one sample at
+    // a time, on the dynamic layer stack and, if the shape has a specialization, on a StaticMLP copy
+    // of the trained parameters. Prints mean and median latency per image and checks that both paths
+    // predict the same classes.
+    void benchmarkInferenceLatency(size_t sampleCount) const {
+        sampleCount = std::min(sampleCount, testingData->size());
+        if (sampleCount == 0) {
+            return;
+        }
+
+        Eigen::setNbThreads(1);
+
+        Matrix images(inputSize, static_cast<Eigen::Index>(sampleCount));
+        Matrix labels(outputSize, static_cast<Eigen::Index>(sampleCount));
+        testingData->gather(0, sampleCount, images, labels);
+
+        std::vector<int> predictions(sampleCount);
+        std::vector<double> latencies(sampleCount);
+
+        auto report = [&](const std::string& path) {
+            const double mean = std::accumulate(latencies.begin(), latencies.end(), 0.0) / static_cast<double>(sampleCount);
+            std::nth_element(latencies.begin(), latencies.begin() + sampleCount / 2, latencies.end());
+            std::cout << std::setw(12) << path << std::fixed << std::setprecision(2) << std::setw(12) << mean
+                      << std::setw(12) << latencies[sampleCount / 2] << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+        };
+
+        std::cout << "Single-image inference latency over " << sampleCount << " test samples:" << std::endl;
+        std::cout << std::setw(12) << "path" << std::setw(12) << "mean us" << std::setw(12) << "median us" << std::endl;
+
+        Workspace<Scalar> workspace;
+        prepareWorkspace(workspace, 1, false);
+        for (size_t i = 0; i < sampleCount; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            forwardPass(images.col(static_cast<Eigen::Index>(i)), workspace).col(0).maxCoeff(&predictions[i]);
+            latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        report("dynamic");
+
+        bool specialized = withStaticMLP<Scalar>(inputSize, hiddenSize, outputSize, [&](auto& network) {
+            network.load(layers);
+
+            size_t mismatches = 0;
+            for (size_t i = 0; i < sampleCount; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                int prediction = network.predict(images.col(static_cast<Eigen::Index>(i)));
+                latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+                mismatches += prediction != predictions[i];
+            }
+            report("static");
+
+            if (mismatches > 0) {
+                std::cout << mismatches << " predictions differ between the dynamic and the static path" << std::endl;
+            }
+        });
+
+        if (!specialized) {
+            std::cout << "No static specialization for " << inputSize << "-" << hiddenSize << "-" << outputSize
+                      << ", dynamic path only" << std::endl;
+        }
+    }
+
+    // Quantizes the trained network to int8 and runs the test set through both the floating point
+    // network and the integer engine. The engine reads the raw pixels where the dataset keeps them
+    // and otherwise gets the pixels back from the normalized values. Prints accuracy and time of
+    // both models, the accuracy delta and the parameter sizes.
+    void compareQuantized() {
+        const QuantizedNetwork quantized(layers);
+
+        size_t floatBytes = 0;
+        for (const auto& layer : layers) {
+            for (const auto& parameter : layer->parameters()) {
+                floatBytes += static_cast<size_t>(parameter.size()) * sizeof(Scalar);
+            }
+        }
+
+        EvaluationResult reference = evaluate("");
+
+        auto start = std::chrono::steady_clock::now();
+
+        const size_t sampleCount = testingData->size();
+        const size_t batchCount = (sampleCount + evaluationBatchSize - 1) / evaluationBatchSize;
+        const size_t workers = std::max<size_t>(std::min(threadCount, batchCount), 1);
+        evaluationWorkspaces.resize(workers);
+        std::vector<size_t> correct(workers, 0);
+
+        forEachWorker(static_cast<Eigen::Index>(workers), [&](Eigen::Index worker) {
+            Workspace<Scalar>& workspace = evaluationWorkspaces[worker];
+            prepareWorkspace(workspace, evaluationBatchSize, false);
+            QuantizedNetwork::Workspace engineWorkspace;
+            std::vector<uint8_t> recovered(quantized.inputSize());
+
+            for (size_t batch = worker; batch < batchCount; batch += workers) {
+                const size_t first = batch * evaluationBatchSize;
+                const auto columns = static_cast<Eigen::Index>(std::min(evaluationBatchSize, sampleCount - first));
+                auto images = workspace.images.leftCols(columns);
+                auto labels = workspace.labels.leftCols(columns);
+                testingData->gather(first, columns, images, labels);
+
+                for (Eigen::Index column = 0; column < columns; ++column) {
+                    const uint8_t* pixels = testingData->pixels(first + column);
+                    if (pixels == nullptr) {
+                        for (size_t i = 0; i < recovered.size(); ++i) {
+                            recovered[i] = static_cast<uint8_t>(std::lround(images(static_cast<Eigen::Index>(i), column) * Scalar(255)));
+                        }
+                        pixels = recovered.data();
+                    }
 
-            // Get the index of the maximum element in the label vector
-            int actualLabel;
-            testingLabelData[datasetIndex].maxCoeff(&actualLabel);
+                    int label;
+                    labels.col(column).maxCoeff(&label);
+                    correct[worker] += quantized.predict(pixels, engineWorkspace) == label;
+                }
+            }
+        });
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double accuracy = 100.0 * static_cast<double>(std::accumulate(correct.begin(), correct.end(), size_t(0)))
+                                / static_cast<double>(sampleCount);
+
+        std::cout << "Int8 quantization (" << integerDotLevelName(activeIntegerDotLevel()) << " kernel), "
+                  << sampleCount << " test samples:" << std::endl;
+        std::cout << std::setw(8) << "model" << std::setw(12) << "accuracy" << std::setw(12) << "seconds"
+                  << std::setw(14) << "parameters" << std::endl;
+        std::cout << std::fixed << std::setprecision(2) << std::setw(8) << (sizeof(Scalar) == 4 ? "float" : "double")
+                  << std::setw(11) << reference.accuracy() << "%" << std::setprecision(4) << std::setw(12)
+                  << reference.seconds << std::setw(12) << floatBytes / 1024 << " KB" << std::endl;
+        std::cout << std::setprecision(2) << std::setw(8) << "int8" << std::setw(11) << accuracy << "%"
+                  << std::setprecision(4) << std::setw(12) << seconds << std::setw(12)
+                  << quantized.parameterBytes() / 1024 << " KB" << std::endl;
+        std::cout << std::setprecision(2) << "Accuracy delta: " << std::showpos << accuracy - reference.accuracy()
+                  << std::noshowpos << " percentage points, parameters "
+                  << static_cast<double>(floatBytes) / static_cast<double>(quantized.parameterBytes()) << "x smaller"
+                  << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setprecision(6);
+    }
+
+    // Runs the test set through the network on the inference path and returns accuracy and confusion
+    // matrix. Batches are spread over the worker threads, each with its own workspace, so neither the
+    // training workspaces nor the parameters are touched. Every prediction is logged to logFile
+    // unless it is empty.
+    EvaluationResult evaluate(const std::string& logFile) {
+        return evaluate(*testingData, logFile);
+    }
+
+    // Like evaluate, for the samples of any dataset.
+    EvaluationResult evaluate(const Dataset<Scalar>& data, const std::string& logFile) {
+        NN_PROFILE_SCOPE("evaluate");
+        auto start = std::chrono::steady_clock::now();
+
+        const size_t sampleCount = data.size();
+        const size_t batchCount = (sampleCount + evaluationBatchSize - 1) / evaluationBatchSize;
+        const size_t workers = std::max<size_t>(std::min(threadCount, batchCount), 1);
+
+        evaluationWorkspaces.resize(workers);
+        predictedLabels.resize(sampleCount);
+        actualLabels.resize(sampleCount);
+
+        // Worker w takes the batches w, w + workers, ...
+        forEachWorker(static_cast<Eigen::Index>(workers), [&](Eigen::Index worker) {
+            Workspace<Scalar>& workspace = evaluationWorkspaces[worker];
+            prepareWorkspace(workspace, evaluationBatchSize, false);
+
+            for (size_t batch = worker; batch < batchCount; batch += workers) {
+                const size_t first = batch * evaluationBatchSize;
+                const auto columns = static_cast<Eigen::Index>(std::min(evaluationBatchSize, sampleCount - first));
+                auto images = workspace.images.leftCols(columns);
+                auto labels = workspace.labels.leftCols(columns);
+                {
+                    NN_PROFILE_SCOPE("evaluation gather");
+                    data.gather(first, columns, images, labels);
+                }
+
+                // Forward pass
+                ConstRef outputs = forwardPass(images, workspace);
+
+                for (Eigen::Index column = 0; column < columns; ++column) {
+                    // Get the index of the maximum element in the output vector (probabilities or
+                    // logits, softmax does not change the argmax) and in the label vector
+                    outputs.col(column).maxCoeff(&predictedLabels[first + column]);
+                    labels.col(column).maxCoeff(&actualLabels[first + column]);
+                }
+            }
+        });
 
+        EvaluationResult result;
+        result.total = sampleCount;
+        result.confusion.setZero(outputSize, outputSize);
+
+        // One buffered log for the whole run instead of opening the file per prediction
+        std::unique_ptr<PredictionLog> predictionLog;
+        if (!logFile.empty()) {
+            predictionLog = std::make_unique<PredictionLog>(logFile, backgroundLogging);
+        }
+
+        for (size_t i = 0; i < sampleCount; ++i) {
             // Log the prediction as per the format
-            logPrediction(predictionLabel, actualLabel, datasetIndex, filename);
+            if (predictionLog) {
+                predictionLog->log(predictedLabels[i], actualLabels[i], static_cast<int>(i));
+            }
 
-            // Update correct and incorrect counts
-            if (predictionLabel == actualLabel) {
-                correct++;
-            } else {
-                incorrect++;
+            result.confusion(actualLabels[i], predictedLabels[i])++;
+            if (predictedLabels[i] == actualLabels[i]) {
+                result.correct++;
             }
         }
 
-        std::cout << "Correct: " << correct << ", Incorrect: " << incorrect << std::endl;
-        std::cout << "Accuracy: " << (double) correct / (correct + incorrect) * 100 << "%" << std::endl;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    void test(const std::string& filename) {
+        // Total of correct predictions and incorrect predictions
+        EvaluationResult result = evaluate(filename);
+        size_t incorrect = result.total - result.correct;
+
+        std::cout << "Correct: " << result.correct << ", Incorrect: " << incorrect << std::endl;
+        std::cout << "Accuracy: " << result.accuracy() << "%" << std::endl;
+        std::cout << "Evaluation took " << result.seconds << " s" << std::endl;
+
+        std::cout << "Confusion matrix (rows: label, columns: prediction):" << std::endl;
+        std::cout << std::setw(8) << "";
+        for (int predicted = 0; predicted < outputSize; ++predicted) {
+            std::cout << std::setw(7) << predicted;
+        }
+        std::cout << std::endl;
+        for (int label = 0; label < outputSize; ++label) {
+            std::cout << std::setw(8) << label;
+            for (int predicted = 0; predicted < outputSize; ++predicted) {
+                std::cout << std::setw(7) << result.confusion(label, predicted);
+            }
+            std::cout << std::endl;
+        }
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,320 @@
+#pragma once
+#include "layers.hpp"
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Parameter update rules.
+enum class OptimizerType {
+    SGD,
+    Momentum,
+    Adam,
+    AdamW
+};
+
+inline const char* optimizerName(OptimizerType type) {
+    switch (type) {
+        case OptimizerType::Momentum:
+            return "momentum";
+        case OptimizerType::Adam:
+            return "adam";
+        case OptimizerType::AdamW:
+            return "adamw";
+        default:
+            return "sgd";
+    }
+}
+
+// Parses "sgd", "momentum", "adam" or "adamw". Returns false for anything else.
+inline bool parseOptimizerType(const std::string& name, OptimizerType& type) {
+    for (OptimizerType candidate : {OptimizerType::SGD, OptimizerType::Momentum, OptimizerType::Adam, OptimizerType::AdamW}) {
+        if (name == optimizerName(candidate)) {
+            type = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hyperparameters of the optimizers; every optimizer reads the ones it uses. The learning rate is
+// passed per step, so it can change during training.
+struct OptimizerSettings {
+    OptimizerType type = OptimizerType::SGD;
+    double momentum = 0.9;       // Velocity decay of Momentum.
+    double beta1 = 0.9;          // First moment decay of Adam and AdamW.
+    double beta2 = 0.999;        // Second moment decay of Adam and AdamW.
+    double epsilon = 1e-8;       // Denominator offset of Adam and AdamW.
+    double weightDecay = 0.01;   // Decoupled weight decay of AdamW, applied to weights but not biases.
+    size_t accumulationSteps = 1; // Number of batches whose gradients are averaged into one update.
+};
+
+// Turns the parameter gradients of a pass into parameter updates. The optimizer sees every layer
+// with parameters as two contiguous blocks, weights and biases, paired with the weightGradient and
+// biasGradient of the layer's LayerState, and keeps its own state per block. All state is sized
+// once by prepare, so steps do not allocate.
+//
+// Stateful optimizers update parameter and state in a single vectorized sweep per block. Besides
+// touching every value only once, this keeps each parameter consistent with the state values it was
+// computed from when Hogwild workers update the same block concurrently.
+template<typename Scalar>
+class Optimizer {
+public:
+    using Layers = std::vector<std::shared_ptr<BaseLayer<Scalar>>>;
+    using States = std::vector<LayerState<Scalar>>;
+
+protected:
+    using Array = Eigen::Array<Scalar, Eigen::Dynamic, 1>;
+    using ArrayMap = Eigen::Map<Array>;
+    using ConstArrayMap = Eigen::Map<const Array>;
+
+    // Parameter block of a layer.
+    struct Block {
+        size_t layer;
+        Scalar* values;
+        Eigen::Index size;
+        bool bias;
+    };
+
+    std::vector<Block> blocks;
+
+    // Gradient sums of the batches since the last update, only used with accumulation.
+    size_t accumulationSteps;
+    std::vector<Array> accumulated;
+    size_t pending = 0;
+    Scalar pendingRate = 0;  // Learning rate of the latest accumulated batch.
+
+    // Number of updates so far. Atomic because Hogwild workers step concurrently.
+    std::atomic<uint64_t> updates{0};
+
+public:
+    explicit Optimizer(size_t accumulationSteps) : accumulationSteps(std::max<size_t>(accumulationSteps, 1)) {}
+
+    virtual ~Optimizer() = default;
+
+    // Registers the parameter blocks of the layers and sizes the optimizer state for them. Does
+    // nothing if the blocks are already registered.
+    void prepare(const Layers& layers) {
+        if (!blocks.empty()) {
+            return;
+        }
+
+        for (size_t i = 0; i < layers.size(); ++i) {
+            std::vector<typename BaseLayer<Scalar>::MatrixRef> parameters = layers[i]->parameters();
+            if (parameters.empty()) {
+                continue;
+            }
+            if (parameters.size() != 2) {
+                throw std::runtime_error("Optimizers expect layers with exactly weights and biases");
+            }
+            blocks.push_back({i, parameters[0].data(), parameters[0].size(), false});
+            blocks.push_back({i, parameters[1].data(), parameters[1].size(), true});
+        }
+
+        for (const Block& block : blocks) {
+            if (accumulationSteps > 1) {
+                accumulated.push_back(Array::Zero(block.size));
+            }
+            addState(block);
+        }
+    }
+
+    // Takes the gradients of one batch from the layer states. Without accumulation the parameters
+    // are updated right away; with it, the gradients are summed and every accumulationSteps-th call
+    // updates the parameters with their average. Returns whether the parameters changed. A sparse
+    // step may skip parameters whose gradient is known to be zero.
+    bool step(const Layers& layers, const States& states, Scalar learningRate, bool sparse = false) {
+        if (accumulationSteps == 1) {
+            apply(layers, states, learningRate, sparse);
+            return true;
+        }
+
+        for (size_t k = 0; k < blocks.size(); ++k) {
+            accumulated[k] += gradient(blocks[k], states);
+        }
+        pendingRate = learningRate;
+        if (++pending < accumulationSteps) {
+            return false;
+        }
+        applyAccumulated();
+        return true;
+    }
+
+    // Updates the parameters with the average of the gradients accumulated since the last update,
+    // if there are any, e.g. those of the last batches of an epoch that did not fill a whole
+    // accumulation window. Returns whether the parameters changed.
+    bool flush() {
+        if (pending == 0) {
+            return false;
+        }
+        applyAccumulated();
+        return true;
+    }
+
+protected:
+    // Averages the pending accumulated gradients into one update with the latest learning rate.
+    void applyAccumulated() {
+        const uint64_t updateIndex = ++updates;
+        const Scalar scale = Scalar(1) / static_cast<Scalar>(pending);
+        for (size_t k = 0; k < blocks.size(); ++k) {
+            accumulated[k] *= scale;
+            this->update(k, parameter(blocks[k]), ConstArrayMap(accumulated[k].data(), blocks[k].size), pendingRate, updateIndex);
+            accumulated[k].setZero();
+        }
+        pending = 0;
+    }
+
+    // Sizes the optimizer state of one more block.
+    virtual void addState(const Block&) {}
+
+    // Updates all blocks with the gradients of the states.
+    virtual void apply(const Layers&, const States& states, Scalar learningRate, bool) {
+        const uint64_t updateIndex = ++updates;
+        for (size_t k = 0; k < blocks.size(); ++k) {
+            this->update(k, parameter(blocks[k]), gradient(blocks[k], states), learningRate, updateIndex);
+        }
+    }
+
+    // Updates block k in place. updateIndex counts the updates so far, starting at 1.
+    virtual void update(size_t k, ArrayMap parameter, const ConstArrayMap& gradient, Scalar learningRate, uint64_t updateIndex) = 0;
+
+    static ArrayMap parameter(const Block& block) {
+        return {block.values, block.size};
+    }
+
+    static ConstArrayMap gradient(const Block& block, const States& states) {
+        const LayerState<Scalar>& state = states[block.layer];
+        return {block.bias ? state.biasGradient.data() : state.weightGradient.data(), block.size};
+    }
+};
+
+// Plain stochastic gradient descent. Without accumulation the update is left to the layers, so it
+// runs on their compute backend and Hogwild keeps its sparse updates.
+template<typename Scalar>
+class SGDOptimizer : public Optimizer<Scalar> {
+    using typename Optimizer<Scalar>::Layers;
+    using typename Optimizer<Scalar>::States;
+    using typename Optimizer<Scalar>::ArrayMap;
+    using typename Optimizer<Scalar>::ConstArrayMap;
+
+public:
+    using Optimizer<Scalar>::Optimizer;
+
+protected:
+    void apply(const Layers& layers, const States& states, Scalar learningRate, bool sparse) override {
+        ++this->updates;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            if (sparse) {
+                layers[i]->applySparseGradients(states[i], learningRate);
+            } else {
+                layers[i]->applyGradients(states[i], learningRate);
+            }
+        }
+    }
+
+    void update(size_t, ArrayMap parameter, const ConstArrayMap& gradient, Scalar learningRate, uint64_t) override {
+        parameter -= learningRate * gradient;
+    }
+};
+
+// SGD with momentum: v = mu * v + g, p -= lr * v.
+template<typename Scalar>
+class MomentumOptimizer : public Optimizer<Scalar> {
+    using typename Optimizer<Scalar>::Array;
+    using typename Optimizer<Scalar>::ArrayMap;
+    using typename Optimizer<Scalar>::ConstArrayMap;
+    using typename Optimizer<Scalar>::Block;
+
+    Scalar momentum;
+    std::vector<Array> velocities;
+
+public:
+    explicit MomentumOptimizer(const OptimizerSettings& settings)
+            : Optimizer<Scalar>(settings.accumulationSteps), momentum(static_cast<Scalar>(settings.momentum)) {}
+
+protected:
+    void addState(const Block& block) override {
+        velocities.push_back(Array::Zero(block.size));
+    }
+
+    void update(size_t k, ArrayMap parameter, const ConstArrayMap& gradient, Scalar learningRate, uint64_t) override {
+        Scalar* values = parameter.data();
+        Scalar* velocity = velocities[k].data();
+        const Scalar* g = gradient.data();
+
+        #pragma omp simd
+        for (Eigen::Index i = 0; i < parameter.size(); ++i) {
+            const Scalar v = momentum * velocity[i] + g[i];
+            velocity[i] = v;
+            values[i] -= learningRate * v;
+        }
+    }
+};
+
+// Adam with bias-corrected first and second moments. With a non-zero weight decay it is AdamW: the
+// weights shrink by lr * decay per update, decoupled from the gradient moments.
+template<typename Scalar>
+class AdamOptimizer : public Optimizer<Scalar> {
+    using typename Optimizer<Scalar>::Array;
+    using typename Optimizer<Scalar>::ArrayMap;
+    using typename Optimizer<Scalar>::ConstArrayMap;
+    using typename Optimizer<Scalar>::Block;
+
+    Scalar beta1, beta2, epsilon, weightDecay;
+    std::vector<Array> firstMoments, secondMoments;
+
+public:
+    AdamOptimizer(const OptimizerSettings& settings, bool decoupledWeightDecay)
+            : Optimizer<Scalar>(settings.accumulationSteps), beta1(static_cast<Scalar>(settings.beta1)),
+              beta2(static_cast<Scalar>(settings.beta2)), epsilon(static_cast<Scalar>(settings.epsilon)),
+              weightDecay(decoupledWeightDecay ? static_cast<Scalar>(settings.weightDecay) : Scalar(0)) {}
+
+protected:
+    void addState(const Block& block) override {
+        firstMoments.push_back(Array::Zero(block.size));
+        secondMoments.push_back(Array::Zero(block.size));
+    }
+
+    void update(size_t k, ArrayMap parameter, const ConstArrayMap& gradient, Scalar learningRate, uint64_t updateIndex) override {
+        // The bias corrections fold into the step size and the epsilon
+        const auto exponent = static_cast<Scalar>(updateIndex);
+        const Scalar firstCorrection = Scalar(1) - std::pow(beta1, exponent);
+        const Scalar secondCorrection = std::sqrt(Scalar(1) - std::pow(beta2, exponent));
+        const Scalar stepSize = learningRate * secondCorrection / firstCorrection;
+        const Scalar correctedEpsilon = epsilon * secondCorrection;
+        const Scalar decay = this->blocks[k].bias ? Scalar(1) : Scalar(1) - learningRate * weightDecay;
+
+        Scalar* values = parameter.data();
+        Scalar* first = firstMoments[k].data();
+        Scalar* second = secondMoments[k].data();
+        const Scalar* g = gradient.data();
+
+        #pragma omp simd
+        for (Eigen::Index i = 0; i < parameter.size(); ++i) {
+            const Scalar m = beta1 * first[i] + (Scalar(1) - beta1) * g[i];
+            const Scalar v = beta2 * second[i] + (Scalar(1) - beta2) * g[i] * g[i];
+            first[i] = m;
+            second[i] = v;
+            values[i] = decay * values[i] - stepSize * m / (std::sqrt(v) + correctedEpsilon);
+        }
+    }
+};
+
+template<typename Scalar>
+std::unique_ptr<Optimizer<Scalar>> makeOptimizer(const OptimizerSettings& settings) {
+    switch (settings.type) {
+        case OptimizerType::Momentum:
+            return std::make_unique<MomentumOptimizer<Scalar>>(settings);
+        case OptimizerType::Adam:
+            return std::make_unique<AdamOptimizer<Scalar>>(settings, false);
+        case OptimizerType::AdamW:
+            return std::make_unique<AdamOptimizer<Scalar>>(settings, true);
+        default:
+            return std::make_unique<SGDOptimizer<Scalar>>(settings.accumulationSteps);
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <charconv>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Sink for the per-image prediction log. The file is opened once in append mode, lines are
+// formatted into a large buffer, and the buffer is written out in big chunks. With a background
+// writer, a full buffer is handed to a second thread while formatting continues into the other one.
+class PredictionLog {
+private:
+    static constexpr size_t flushThreshold = 1 << 20;
+    static constexpr size_t maxLineLength = 64;
+
+    std::ofstream file;
+    std::string buffer;
+
+    // Background writer state: pending holds the chunk being written and is empty while the
+    // writer is idle.
+    bool background = false;
+    std::string pending;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+    std::thread writer;
+
+public:
+    PredictionLog(const std::string& filename, bool backgroundWriter)
+            : file(filename, std::ios::app | std::ios::binary), background(backgroundWriter) {
+        if (!file) {
+            std::cerr << "Unable to open file for writing.\n";
+            return;
+        }
+
+        buffer.reserve(flushThreshold + maxLineLength);
+        if (background) {
+            pending.reserve(flushThreshold + maxLineLength);
+            writer = std::thread([this] { writeLoop(); });
+        }
+    }
+
+    PredictionLog(const PredictionLog&) = delete;
+    PredictionLog& operator=(const PredictionLog&) = delete;
+
+    ~PredictionLog() {
+        close();
+    }
+
+    // Appends " - image <index>: Prediction=<prediction>. Label=<label>\n".
+    void log(int prediction, int label, int imageIndex) {
+        if (!file.is_open()) {
+            return;
+        }
+
+        buffer += " - image ";
+        appendNumber(imageIndex);
+        buffer += ": Prediction=";
+        appendNumber(prediction);
+        buffer += ". Label=";
+        appendNumber(label);
+        buffer += '\n';
+
+        if (buffer.size() >= flushThreshold) {
+            flush();
+        }
+    }
+
+    // Writes out everything logged so far, or hands it to the background writer.
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+
+        if (!background) {
+            file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+            return;
+        }
+
+        // Wait until the writer is done with the previous chunk, then swap buffers
+        std::unique_lock lock(mutex);
+        condition.wait(lock, [this] { return pending.empty(); });
+        pending.swap(buffer);
+        lock.unlock();
+        condition.notify_all();
+    }
+
+    // Flushes the remaining lines, stops the background writer and closes the file.
+    void close() {
+        if (!file.is_open()) {
+            return;
+        }
+
+        flush();
+        if (writer.joinable()) {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            condition.notify_all();
+            writer.join();
+        }
+        file.close();
+    }
+
+private:
+    void appendNumber(int value) {
+        char digits[16];
+        auto [end, error] = std::to_chars(digits, digits + sizeof(digits), value);
+        buffer.append(digits, end);
+    }
+
+    void writeLoop() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            condition.wait(lock, [this] { return !pending.empty() || stopping; });
+            if (pending.empty()) {
+                return;
+            }
+
+            // The producer only touches pending while it is empty, so it can be written unlocked
+            lock.unlock();
+            file.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+            lock.lock();
+
+            pending.clear();
+            condition.notify_all();
+        }
+    }
+};
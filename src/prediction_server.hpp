@@ -0,0 +1,443 @@
+#pragma once
+#include "nn.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct ServerSettings {
+    std::string endpoint;                              // Unix domain socket path, or "stdin".
+    size_t maxBatch = 32;                              // Largest micro-batch of one forward pass.
+    std::chrono::microseconds maxDelay{1000};          // Longest a request waits for a batch to fill.
+    std::chrono::duration<double> reportInterval{10.0}; // Time between latency reports.
+};
+
+// Long-running inference on a trained network. Every request is one image of raw 8 bit pixels and
+// is answered with its predicted class.
+//
+// Over a Unix domain socket, clients write images back to back on a stream connection and read one
+// byte per image, the class, in the order of their images. With "stdin", images are read from
+// standard input and the classes are written to standard output, one per line.
+//
+// A single I/O thread reads the requests and appends them to a queue. A batcher thread takes up to
+// maxBatch of them at a time and runs them through one batched forward pass: it starts a batch as
+// soon as the queue holds maxBatch requests, or when the oldest one has waited maxDelay, so a lone
+// request is answered after at most maxDelay plus one pass while concurrent ones share the cost of
+// a pass. Latencies are measured from the complete arrival of a request to its answer, and
+// reported with the throughput every reportInterval and at shutdown, which SIGINT or SIGTERM
+// start once the queued requests are answered. Answers never block the batcher: a client that
+// stops reading until its socket buffer is full is disconnected.
+template<typename Scalar>
+class PredictionServer {
+    using Clock = std::chrono::steady_clock;
+    using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
+    // A client connection, closed once the last answer for it has been written.
+    struct Connection {
+        int fd;
+        bool dropped = false;  // Set by the batcher when answers can no longer be sent.
+        explicit Connection(int descriptor) : fd(descriptor) {}
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+        ~Connection() { ::close(fd); }
+    };
+
+    struct Request {
+        std::shared_ptr<Connection> connection;  // nullptr for standard input.
+        Clock::time_point arrival;
+    };
+
+    // Requests read by the I/O thread, of which the batcher takes the oldest. Taken requests stay in
+    // the vectors before head until the queue runs empty or they make up half of it, so taking a
+    // batch does not move the rest of the queue.
+    struct Queue {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<uint8_t> pixels;
+        std::vector<Request> requests;
+        size_t head = 0;
+        bool closed = false;
+
+        [[nodiscard]] size_t size() const { return requests.size() - head; }
+    };
+
+    // Latency counts in logarithmic buckets, 16 per power of two of microseconds, so percentiles of
+    // any number of requests are known to within 1/16 in constant memory.
+    struct LatencyHistogram {
+        static constexpr int bucketsPerOctave = 16;
+        static constexpr int octaves = 40;
+        std::array<uint64_t, bucketsPerOctave * octaves + 1> counts{};
+        uint64_t total = 0;
+        double maximum = 0.0;
+
+        void add(double microseconds) {
+            ++counts[bucket(microseconds)];
+            ++total;
+            maximum = std::max(maximum, microseconds);
+        }
+
+        void clear() {
+            counts.fill(0);
+            total = 0;
+            maximum = 0.0;
+        }
+
+        // Upper bound of the bucket holding the given fraction of the requests.
+        [[nodiscard]] double percentile(double fraction) const {
+            const auto rank = std::min(total - 1, static_cast<uint64_t>(fraction * static_cast<double>(total)));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < counts.size(); ++i) {
+                seen += counts[i];
+                if (seen > rank) {
+                    return std::min(upperBound(i), maximum);
+                }
+            }
+            return maximum;
+        }
+
+    private:
+        // Bucket 0 holds everything below 1 us, bucket 1 + 16 e + s the values in
+        // [2^e (1 + s / 16), 2^e (1 + (s + 1) / 16)).
+        static size_t bucket(double microseconds) {
+            if (!(microseconds >= 1.0)) {
+                return 0;
+            }
+            int exponent;
+            const double mantissa = std::frexp(microseconds, &exponent);  // In [0.5, 1).
+            const auto index = static_cast<size_t>((exponent - 1) * bucketsPerOctave)
+                               + static_cast<size_t>((mantissa * 2.0 - 1.0) * bucketsPerOctave);
+            return std::min(index + 1, static_cast<size_t>(bucketsPerOctave * octaves));
+        }
+
+        static double upperBound(size_t bucket) {
+            if (bucket == 0) {
+                return 1.0;
+            }
+            const auto exponent = static_cast<int>((bucket - 1) / bucketsPerOctave);
+            const auto step = static_cast<double>((bucket - 1) % bucketsPerOctave + 1);
+            return std::ldexp(1.0 + step / bucketsPerOctave, exponent);
+        }
+    };
+
+    // Latencies and batches since the last report and since the start.
+    struct Statistics {
+        LatencyHistogram recent, lifetime;
+        size_t recentBatches = 0, lifetimeBatches = 0;
+        Clock::time_point start, lastReport;
+    };
+
+    static inline std::atomic<bool> stopRequested{false};
+
+    const NeuralNetwork<Scalar>& network;
+    ServerSettings settings;
+    size_t imageSize;
+    Queue queue;
+    Statistics statistics;
+
+public:
+    PredictionServer(const NeuralNetwork<Scalar>& network, size_t imageSize, ServerSettings serverSettings)
+            : network(network), settings(std::move(serverSettings)), imageSize(imageSize) {
+        settings.maxBatch = std::max<size_t>(settings.maxBatch, 1);
+    }
+
+    // Serves until SIGINT or SIGTERM, or the end of standard input, and prints the final report.
+    void run() {
+        stopRequested.store(false);
+        struct sigaction action {};
+        action.sa_handler = [](int) { stopRequested.store(true); };
+        sigemptyset(&action.sa_mask);
+        // Without SA_RESTART, so a blocking read or poll returns when a signal arrives
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        statistics.start = statistics.lastReport = Clock::now();
+        std::thread batcher([this] { batchRequests(); });
+
+        std::cerr << "Serving on " << settings.endpoint << " with batches of up to " << settings.maxBatch
+                  << " images and a deadline of " << settings.maxDelay.count() << " us" << std::endl;
+        try {
+            if (settings.endpoint == "stdin") {
+                readStandardInput();
+            } else {
+                readSocket();
+            }
+        } catch (...) {
+            closeQueue();
+            batcher.join();
+            throw;
+        }
+        closeQueue();
+        batcher.join();
+
+        const LatencyHistogram& lifetime = statistics.lifetime;
+        std::cerr << "Served " << lifetime.total << " requests in " << statistics.lifetimeBatches << " batches" << std::endl;
+        if (lifetime.total > 0) {
+            report("Total", Clock::now() - statistics.start, lifetime.total, statistics.lifetimeBatches,
+                   lifetime.percentile(0.5), lifetime.percentile(0.99), lifetime.maximum);
+        }
+    }
+
+private:
+    // Appends count images from pixels to the queue.
+    void enqueue(const uint8_t* pixels, size_t count, const std::shared_ptr<Connection>& connection) {
+        const Clock::time_point arrival = Clock::now();
+        {
+            std::lock_guard lock(queue.mutex);
+            queue.pixels.insert(queue.pixels.end(), pixels, pixels + count * imageSize);
+            for (size_t i = 0; i < count; ++i) {
+                queue.requests.push_back({connection, arrival});
+            }
+        }
+        queue.ready.notify_one();
+    }
+
+    void closeQueue() {
+        {
+            std::lock_guard lock(queue.mutex);
+            queue.closed = true;
+        }
+        queue.ready.notify_one();
+    }
+
+    void readStandardInput() {
+        std::vector<uint8_t> buffer(imageSize * settings.maxBatch);
+        size_t filled = 0;
+        while (!stopRequested.load()) {
+            const ssize_t received = ::read(STDIN_FILENO, buffer.data() + filled, buffer.size() - filled);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received < 0) {
+                throw std::runtime_error(std::string("Could not read standard input: ") + std::strerror(errno));
+            }
+            if (received == 0) {
+                if (filled > 0) {
+                    std::cerr << "Ignoring " << filled << " trailing bytes of an incomplete image" << std::endl;
+                }
+                return;
+            }
+            filled += static_cast<size_t>(received);
+            const size_t complete = filled / imageSize;
+            enqueue(buffer.data(), complete, nullptr);
+            std::copy(buffer.begin() + static_cast<std::ptrdiff_t>(complete * imageSize),
+                      buffer.begin() + static_cast<std::ptrdiff_t>(filled), buffer.begin());
+            filled -= complete * imageSize;
+        }
+    }
+
+    void readSocket() {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (settings.endpoint.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + settings.endpoint);
+        }
+        std::strcpy(address.sun_path, settings.endpoint.c_str());
+
+        const int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0) {
+            throw std::runtime_error(std::string("Could not create socket: ") + std::strerror(errno));
+        }
+        Connection listening(listener);
+
+        // A socket file left behind by an earlier run would make bind fail
+        ::unlink(settings.endpoint.c_str());
+        if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listener, SOMAXCONN) < 0) {
+            throw std::runtime_error("Could not listen on " + settings.endpoint + ": " + std::strerror(errno));
+        }
+
+        // Every client gets a buffer of maxBatch images, so one read can carry a whole batch
+        struct Client {
+            std::shared_ptr<Connection> connection;
+            std::vector<uint8_t> buffer;
+            size_t filled = 0;
+        };
+        std::vector<Client> clients;
+        std::vector<pollfd> descriptors;
+
+        while (!stopRequested.load()) {
+            descriptors.clear();
+            descriptors.push_back({listener, POLLIN, 0});
+            for (const Client& client : clients) {
+                descriptors.push_back({client.connection->fd, POLLIN, 0});
+            }
+
+            // Wakes up regularly to notice a stop request that arrived outside of poll
+            const int events = ::poll(descriptors.data(), descriptors.size(), 100);
+            if (events < 0 && errno == EINTR) {
+                continue;
+            }
+            if (events < 0) {
+                throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+            }
+
+            // Clients are only removed below, so descriptors[i + 1] belongs to clients[i]
+            for (size_t i = 0; i < clients.size(); ++i) {
+                if (descriptors[i + 1].revents == 0) {
+                    continue;
+                }
+                Client& client = clients[i];
+                const ssize_t received = ::read(client.connection->fd, client.buffer.data() + client.filled,
+                                                client.buffer.size() - client.filled);
+                if (received < 0 && (errno == EINTR || errno == EAGAIN)) {
+                    continue;
+                }
+                if (received <= 0) {
+                    // Disconnected; the connection closes once its queued requests are answered
+                    client.connection.reset();
+                    continue;
+                }
+                client.filled += static_cast<size_t>(received);
+                const size_t complete = client.filled / imageSize;
+                enqueue(client.buffer.data(), complete, client.connection);
+                std::copy(client.buffer.begin() + static_cast<std::ptrdiff_t>(complete * imageSize),
+                          client.buffer.begin() + static_cast<std::ptrdiff_t>(client.filled), client.buffer.begin());
+                client.filled -= complete * imageSize;
+            }
+            std::erase_if(clients, [](const Client& client) { return client.connection == nullptr; });
+
+            if (descriptors[0].revents & POLLIN) {
+                // Non-blocking, so a client that does not read its answers cannot stall the batcher
+                const int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    clients.push_back({std::make_shared<Connection>(fd), std::vector<uint8_t>(imageSize * settings.maxBatch), 0});
+                }
+            }
+        }
+
+        ::unlink(settings.endpoint.c_str());
+    }
+
+    // Runs on its own thread until the queue is closed and empty.
+    void batchRequests() {
+        NN_PROFILE_THREAD("prediction batcher");
+        const size_t capacity = settings.maxBatch;
+        Matrix images(static_cast<Eigen::Index>(imageSize), static_cast<Eigen::Index>(capacity));
+        Workspace<Scalar> workspace;
+        network.prepareWorkspace(workspace, static_cast<Eigen::Index>(capacity), false);
+
+        std::vector<uint8_t> pixels(imageSize * capacity);
+        std::vector<Request> batch;
+        batch.reserve(capacity);
+
+        while (true) {
+            {
+                std::unique_lock lock(queue.mutex);
+                queue.ready.wait(lock, [&] { return queue.size() > 0 || queue.closed; });
+                if (queue.size() == 0) {
+                    return;
+                }
+
+                // Give the batch until the deadline of its oldest request to fill up
+                const Clock::time_point deadline = queue.requests[queue.head].arrival + settings.maxDelay;
+                queue.ready.wait_until(lock, deadline, [&] { return queue.size() >= capacity || queue.closed; });
+
+                // Requests of clients that can no longer be answered are skipped
+                while (batch.size() < capacity && queue.head < queue.requests.size()) {
+                    Request& request = queue.requests[queue.head];
+                    if (!request.connection || !request.connection->dropped) {
+                        std::copy_n(queue.pixels.begin() + static_cast<std::ptrdiff_t>(queue.head * imageSize), imageSize,
+                                    pixels.begin() + static_cast<std::ptrdiff_t>(batch.size() * imageSize));
+                        batch.push_back(std::move(request));
+                    }
+                    request.connection.reset();
+                    ++queue.head;
+                }
+
+                if (queue.head == queue.requests.size()) {
+                    queue.pixels.clear();
+                    queue.requests.clear();
+                    queue.head = 0;
+                } else if (queue.head * 2 >= queue.requests.size()) {
+                    const auto taken = static_cast<std::ptrdiff_t>(queue.head);
+                    queue.pixels.erase(queue.pixels.begin(), queue.pixels.begin() + taken * static_cast<std::ptrdiff_t>(imageSize));
+                    queue.requests.erase(queue.requests.begin(), queue.requests.begin() + taken);
+                    queue.head = 0;
+                }
+            }
+            if (batch.empty()) {
+                continue;
+            }
+
+            NN_PROFILE_SCOPE("prediction batch");
+            const auto columns = static_cast<Eigen::Index>(batch.size());
+            using ByteMatrix = Eigen::Map<const Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic>>;
+            images.leftCols(columns) = ByteMatrix(pixels.data(), static_cast<Eigen::Index>(imageSize), columns).template cast<Scalar>()
+                                       / static_cast<Scalar>(255);
+            auto outputs = network.predict(images.leftCols(columns), workspace);
+
+            bool toStandardOutput = false;
+            for (Eigen::Index i = 0; i < columns; ++i) {
+                Eigen::Index predicted;
+                outputs.col(i).maxCoeff(&predicted);
+                Request& request = batch[static_cast<size_t>(i)];
+                if (request.connection && !request.connection->dropped) {
+                    // A client that went away only loses its own answers; its queued requests are
+                    // skipped. One whose socket buffer is full has stopped reading and is
+                    // disconnected, which the I/O thread notices as the end of its stream.
+                    Connection& connection = *request.connection;
+                    const auto answer = static_cast<uint8_t>(predicted);
+                    if (::send(connection.fd, &answer, 1, MSG_NOSIGNAL) < 0 && errno != EINTR) {
+                        connection.dropped = true;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            ::shutdown(connection.fd, SHUT_RDWR);
+                            std::cerr << "Disconnected a client that stopped reading its answers" << std::endl;
+                        }
+                    }
+                } else if (!request.connection) {
+                    std::cout << predicted << '\n';
+                    toStandardOutput = true;
+                }
+                const double latency = std::chrono::duration<double, std::micro>(Clock::now() - request.arrival).count();
+                statistics.recent.add(latency);
+                statistics.lifetime.add(latency);
+            }
+            if (toStandardOutput) {
+                std::cout.flush();
+            }
+            batch.clear();
+            ++statistics.recentBatches;
+            ++statistics.lifetimeBatches;
+
+            const Clock::time_point now = Clock::now();
+            if (now - statistics.lastReport >= settings.reportInterval) {
+                const LatencyHistogram& recent = statistics.recent;
+                report("Last", now - statistics.lastReport, recent.total, statistics.recentBatches, recent.percentile(0.5),
+                       recent.percentile(0.99), recent.maximum);
+                statistics.recent.clear();
+                statistics.recentBatches = 0;
+                statistics.lastReport = now;
+            }
+        }
+    }
+
+    // Prints throughput, mean batch size and latency percentiles in microseconds.
+    static void report(const std::string& label, Clock::duration elapsed, size_t requests, size_t batches, double p50,
+                       double p99, double maximum) {
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        std::cerr << std::fixed << std::setprecision(1) << label << " " << seconds << " s: " << requests << " requests, "
+                  << static_cast<double>(requests) / seconds << " requests/s, mean batch "
+                  << static_cast<double>(requests) / static_cast<double>(batches) << ", latency p50 " << p50
+                  << " us, p99 " << p99 << " us, max " << maximum << " us" << std::endl;
+        std::cerr.unsetf(std::ios::fixed);
+        std::cerr << std::setprecision(6);
+    }
+};
@@ -0,0 +1,255 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Scoped timers for the hot paths of training and inference. Code marks a region with
+// NN_PROFILE_SCOPE("name"), or NN_PROFILE_ZONE(zone) for a zone registered at runtime, and the
+// time between the mark and the end of the enclosing scope is added to the zone's totals, and
+// with tracing also recorded as an event. The macros only expand to timers when the build defines
+// NN_PROFILING (CMake option NN_PROFILING), so a regular build carries no trace of them.
+//
+// Every thread records into its own buffer, so timers never contend: totals are relaxed atomics
+// written by their thread only, and trace events go into a block sized when the thread first
+// records, so a running profiler does not allocate. Events beyond its capacity are dropped and
+// counted.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t maxZones = 128;
+
+    struct ZoneTotal {
+        std::string name;
+        uint64_t calls = 0;
+        double seconds = 0.0;
+    };
+
+private:
+    struct Event {
+        uint32_t zone;
+        int64_t start;    // Nanoseconds since the profiler was enabled.
+        int64_t duration; // Nanoseconds.
+    };
+
+    struct ThreadBuffer {
+        uint32_t id = 0;
+        std::string name;
+        std::array<std::atomic<uint64_t>, maxZones> calls{};
+        std::array<std::atomic<uint64_t>, maxZones> nanoseconds{};
+        std::unique_ptr<Event[]> events;
+        size_t capacity = 0;
+        std::atomic<size_t> eventCount{0};
+        std::atomic<uint64_t> dropped{0};
+
+        // Totals up to the last takeTotals, only touched by the reader.
+        std::array<uint64_t, maxZones> reportedCalls{};
+        std::array<uint64_t, maxZones> reportedNanoseconds{};
+    };
+
+    std::mutex mutex;
+    std::vector<std::string> zoneNames;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+    std::atomic<bool> active{false};
+    bool tracing = false;
+    size_t eventCapacity = 0;
+    Clock::time_point origin = Clock::now();
+
+public:
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // Returns the id of the zone with the given name, registering it on first use.
+    uint32_t zone(const std::string& name) {
+        std::lock_guard lock(mutex);
+        auto existing = std::find(zoneNames.begin(), zoneNames.end(), name);
+        if (existing != zoneNames.end()) {
+            return static_cast<uint32_t>(existing - zoneNames.begin());
+        }
+        if (zoneNames.size() == maxZones) {
+            throw std::runtime_error("Too many profiler zones");
+        }
+        zoneNames.push_back(name);
+        return static_cast<uint32_t>(zoneNames.size() - 1);
+    }
+
+    // Starts recording. With tracing, every thread keeps up to eventsPerThread events for writeTrace.
+    // Call it before the first timer runs; threads that recorded before keep no events.
+    void enable(bool trace, size_t eventsPerThread = size_t(1) << 20) {
+        std::lock_guard lock(mutex);
+        tracing = trace;
+        eventCapacity = trace ? eventsPerThread : 0;
+        origin = Clock::now();
+        active.store(true);
+    }
+
+    [[nodiscard]] bool enabled() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    // Names the calling thread in the trace.
+    void nameThread(const std::string& name) {
+        ThreadBuffer& buffer = threadBuffer();
+        std::lock_guard lock(mutex);
+        buffer.name = name;
+    }
+
+    // Adds one call of a zone by the calling thread.
+    void record(uint32_t zone, Clock::time_point start, Clock::time_point end) {
+        ThreadBuffer& buffer = threadBuffer();
+        const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        // Only this thread writes its counters, so plain loads and stores are enough
+        buffer.calls[zone].store(buffer.calls[zone].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        buffer.nanoseconds[zone].store(buffer.nanoseconds[zone].load(std::memory_order_relaxed) + static_cast<uint64_t>(duration),
+                                       std::memory_order_relaxed);
+
+        if (buffer.capacity == 0) {
+            return;
+        }
+        const size_t count = buffer.eventCount.load(std::memory_order_relaxed);
+        if (count == buffer.capacity) {
+            buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[count] = {zone, std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count(), duration};
+        buffer.eventCount.store(count + 1, std::memory_order_release);
+    }
+
+    // Returns calls and time per zone, summed over all threads, since the last call, ordered by
+    // time. Zones without calls are left out.
+    std::vector<ZoneTotal> takeTotals() {
+        std::lock_guard lock(mutex);
+        std::vector<ZoneTotal> totals(zoneNames.size());
+        for (size_t zone = 0; zone < zoneNames.size(); ++zone) {
+            totals[zone].name = zoneNames[zone];
+        }
+
+        for (const auto& buffer : threads) {
+            for (size_t zone = 0; zone < zoneNames.size(); ++zone) {
+                const uint64_t calls = buffer->calls[zone].load(std::memory_order_relaxed);
+                const uint64_t nanoseconds = buffer->nanoseconds[zone].load(std::memory_order_relaxed);
+                totals[zone].calls += calls - buffer->reportedCalls[zone];
+                totals[zone].seconds += static_cast<double>(nanoseconds - buffer->reportedNanoseconds[zone]) * 1e-9;
+                buffer->reportedCalls[zone] = calls;
+                buffer->reportedNanoseconds[zone] = nanoseconds;
+            }
+        }
+
+        std::erase_if(totals, [](const ZoneTotal& total) { return total.calls == 0; });
+        std::sort(totals.begin(), totals.end(), [](const ZoneTotal& a, const ZoneTotal& b) { return a.seconds > b.seconds; });
+        return totals;
+    }
+
+    // Writes the recorded events as Chrome trace_event JSON, to be opened in chrome://tracing or
+    // Perfetto. Returns the number of events written; dropped events are reported as metadata.
+    size_t writeTrace(const std::string& path) {
+        std::ofstream file(path);
+        if (!file) {
+            throw std::runtime_error("Could not open trace file " + path);
+        }
+
+        std::lock_guard lock(mutex);
+        size_t written = 0;
+        uint64_t dropped = 0;
+        file << "{\"traceEvents\":[";
+        for (const auto& buffer : threads) {
+            file << (buffer->id > 0 ? ",\n" : "\n") << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << buffer->id
+                 << R"(,"args":{"name":")" << buffer->name << "\"}}";
+
+            const size_t count = buffer->eventCount.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                const Event& event = buffer->events[i];
+                file << ",\n" << R"({"name":")" << zoneNames[event.zone] << R"(","ph":"X","pid":1,"tid":)" << buffer->id
+                     << ",\"ts\":" << event.start / 1000 << "." << std::setfill('0') << std::setw(3) << event.start % 1000
+                     << ",\"dur\":" << event.duration / 1000 << "." << std::setw(3) << event.duration % 1000
+                     << std::setfill(' ') << "}";
+            }
+            written += count;
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+
+        if (!file) {
+            throw std::runtime_error("Could not write trace file " + path);
+        }
+        return written;
+    }
+
+private:
+    ThreadBuffer& threadBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (buffer == nullptr) {
+            std::lock_guard lock(mutex);
+            auto created = std::make_unique<ThreadBuffer>();
+            created->id = static_cast<uint32_t>(threads.size());
+            created->name = "thread " + std::to_string(created->id);
+            created->capacity = eventCapacity;
+            if (eventCapacity > 0) {
+                created->events.reset(new Event[eventCapacity]);
+            }
+            buffer = created.get();
+            threads.push_back(std::move(created));
+        }
+        return *buffer;
+    }
+};
+
+// Adds the time from its construction to its destruction to a zone, if the profiler is enabled.
+class ScopedTimer {
+private:
+    uint32_t zone;
+    bool active;
+    Profiler::Clock::time_point start;
+
+public:
+    explicit ScopedTimer(uint32_t zone) : zone(zone), active(Profiler::instance().enabled()) {
+        if (active) {
+            start = Profiler::Clock::now();
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        if (active) {
+            Profiler::instance().record(zone, start, Profiler::Clock::now());
+        }
+    }
+};
+
+#define NN_PROFILE_CONCAT_INNER(a, b) a##b
+#define NN_PROFILE_CONCAT(a, b) NN_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef NN_PROFILING
+// Times the rest of the enclosing scope as the zone called name, registered once per call site.
+#define NN_PROFILE_SCOPE(name)                                                                  \
+    static const uint32_t NN_PROFILE_CONCAT(profileZone, __LINE__) = Profiler::instance().zone(name); \
+    ScopedTimer NN_PROFILE_CONCAT(profileTimer, __LINE__)(NN_PROFILE_CONCAT(profileZone, __LINE__))
+// Times the rest of the enclosing scope as a zone id from Profiler::zone.
+#define NN_PROFILE_ZONE(zone) ScopedTimer NN_PROFILE_CONCAT(profileTimer, __LINE__)(zone)
+// Names the calling thread in the trace.
+#define NN_PROFILE_THREAD(name)                   \
+    do {                                          \
+        if (Profiler::instance().enabled()) {     \
+            Profiler::instance().nameThread(name); \
+        }                                         \
+    } while (false)
+#else
+#define NN_PROFILE_SCOPE(name) do {} while (false)
+#define NN_PROFILE_ZONE(zone) do {} while (false)
+#define NN_PROFILE_THREAD(name) do {} while (false)
+#endif
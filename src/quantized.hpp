@@ -0,0 +1,183 @@
+#pragma once
+#include "kernels.hpp"
+#include "layers.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// Inference-only int8 copy of a trained dense network, made after training without retraining.
+//
+// Weights are rounded to int8 per output row, with the row's largest magnitude mapped to 127, so a
+// single large weight only coarsens its own row. Activations are quantized to the levels 0 .. 127:
+// the raw uint8 pixels through a lookup table, and the activations between layers per sample with
+// the scale of their maximum, which ReLU keeps non-negative. Each output is then one dot product of
+// bytes in 32 bit integers, scaled back to floating point with the product of the weight row and
+// activation scales, plus the bias, which stays float. Keeping activations below 128 means the
+// pair sums of the AVX2 kernel cannot saturate, so every instruction set gives the same results.
+class QuantizedNetwork {
+public:
+    static constexpr int levels = 127;
+
+    // Buffers of one inference thread, sized on first use.
+    struct Workspace {
+        std::vector<uint8_t> activations;
+        std::vector<float> values;
+    };
+
+private:
+    struct Layer {
+        size_t inputs = 0;
+        size_t outputs = 0;
+        size_t stride = 0;            // Bytes per weight row, padded with zeros to a multiple of 64.
+        std::vector<int8_t> weights;  // outputs x stride, row-major.
+        std::vector<float> scales;    // Value of one weight step, per row.
+        std::vector<float> biases;
+        bool relu = false;
+    };
+
+    std::vector<Layer> layers;
+    std::array<uint8_t, 256> pixelLevels{};
+    float inputScale = 1.0f;  // Value of one input level.
+
+public:
+    // Quantizes a stack of FullyConnected layers with a ReLU after all but the last one, given as
+    // separate layers or fused into FullyConnectedReLU, optionally ending in a SoftMax layer, which
+    // does not change the predicted class and is left out. pixelScale maps raw pixel values to the
+    // inputs the network was trained on.
+    template<typename Scalar>
+    explicit QuantizedNetwork(const std::vector<std::shared_ptr<BaseLayer<Scalar>>>& network, double pixelScale = 1.0 / 255.0) {
+        for (size_t i = 0; i < network.size(); ++i) {
+            const LayerType type = network[i]->type();
+            if (type == LayerType::FullyConnected || type == LayerType::FullyConnectedReLU) {
+                if (!layers.empty() && !layers.back().relu) {
+                    throw std::runtime_error("Quantized networks need a ReLU between dense layers");
+                }
+                layers.push_back(quantizeLayer(*network[i], type == LayerType::FullyConnectedReLU));
+                if (layers.size() > 1 && layers[layers.size() - 2].outputs != layers.back().inputs) {
+                    throw std::runtime_error("Quantized network layer shapes do not match");
+                }
+            } else if (type == LayerType::ReLU && !layers.empty() && !layers.back().relu) {
+                layers.back().relu = true;
+            } else if (type != LayerType::SoftMax || i + 1 != network.size()) {
+                throw std::runtime_error("Quantized networks support dense, ReLU and a final SoftMax layer only");
+            }
+        }
+        if (layers.empty()) {
+            throw std::runtime_error("Quantized network without dense layers");
+        }
+
+        // Pixel p becomes level round(p * 127 / 255), worth 255 / 127 pixel steps
+        for (int pixel = 0; pixel < 256; ++pixel) {
+            pixelLevels[pixel] = static_cast<uint8_t>(std::lround(pixel * levels / 255.0));
+        }
+        inputScale = static_cast<float>(pixelScale * 255.0 / levels);
+    }
+
+    [[nodiscard]] size_t inputSize() const { return layers.front().inputs; }
+    [[nodiscard]] size_t outputSize() const { return layers.back().outputs; }
+
+    // Bytes of the quantized parameters: the padded int8 weights plus the float scales and biases.
+    [[nodiscard]] size_t parameterBytes() const {
+        size_t bytes = 0;
+        for (const Layer& layer : layers) {
+            bytes += layer.weights.size() + (layer.scales.size() + layer.biases.size()) * sizeof(float);
+        }
+        return bytes;
+    }
+
+    // Computes the logits of one image given as inputSize() raw pixels. The logits live in the
+    // workspace until its next use.
+    std::span<const float> forward(const uint8_t* pixels, Workspace& workspace) const {
+        prepare(workspace);
+        uint8_t* activations = workspace.activations.data();
+        float* values = workspace.values.data();
+
+        const Layer& first = layers.front();
+        for (size_t i = 0; i < first.inputs; ++i) {
+            activations[i] = pixelLevels[pixels[i]];
+        }
+        std::fill(activations + first.inputs, activations + first.stride, uint8_t(0));
+        float scale = inputScale;
+
+        for (size_t l = 0; l < layers.size(); ++l) {
+            const Layer& layer = layers[l];
+            for (size_t row = 0; row < layer.outputs; ++row) {
+                const int32_t sum = dotU8S8(activations, layer.weights.data() + row * layer.stride, layer.stride);
+                const float value = static_cast<float>(sum) * (layer.scales[row] * scale) + layer.biases[row];
+                values[row] = layer.relu ? std::max(value, 0.0f) : value;
+            }
+
+            if (l + 1 == layers.size()) {
+                break;
+            }
+
+            // Requantize for the next layer, the largest activation becoming level 127
+            const float maximum = *std::max_element(values, values + layer.outputs);
+            scale = maximum > 0.0f ? maximum / levels : 1.0f;
+            const float inverse = 1.0f / scale;
+            for (size_t i = 0; i < layer.outputs; ++i) {
+                activations[i] = static_cast<uint8_t>(std::lround(values[i] * inverse));
+            }
+            std::fill(activations + layer.outputs, activations + layers[l + 1].stride, uint8_t(0));
+        }
+
+        return {values, layers.back().outputs};
+    }
+
+    // Index of the largest logit of one image of raw pixels.
+    int predict(const uint8_t* pixels, Workspace& workspace) const {
+        std::span<const float> logits = forward(pixels, workspace);
+        return static_cast<int>(std::max_element(logits.begin(), logits.end()) - logits.begin());
+    }
+
+private:
+    template<typename Scalar>
+    static Layer quantizeLayer(const BaseLayer<Scalar>& source, bool relu) {
+        std::vector<Eigen::Ref<const MatrixX<Scalar>>> parameters = source.parameters();
+        const Eigen::Ref<const MatrixX<Scalar>>& weights = parameters[0];
+        const Eigen::Ref<const MatrixX<Scalar>>& biases = parameters[1];
+
+        Layer layer;
+        layer.inputs = static_cast<size_t>(weights.cols());
+        layer.outputs = static_cast<size_t>(weights.rows());
+        layer.stride = (layer.inputs + 63) / 64 * 64;
+        layer.weights.assign(layer.outputs * layer.stride, int8_t(0));
+        layer.scales.resize(layer.outputs);
+        layer.biases.resize(layer.outputs);
+        layer.relu = relu;
+
+        for (size_t row = 0; row < layer.outputs; ++row) {
+            const auto r = static_cast<Eigen::Index>(row);
+            const double maximum = static_cast<double>(weights.row(r).cwiseAbs().maxCoeff());
+            const double scale = maximum > 0.0 ? maximum / levels : 1.0;
+
+            int8_t* quantized = layer.weights.data() + row * layer.stride;
+            for (size_t column = 0; column < layer.inputs; ++column) {
+                quantized[column] = static_cast<int8_t>(std::lround(static_cast<double>(weights(r, static_cast<Eigen::Index>(column))) / scale));
+            }
+            layer.scales[row] = static_cast<float>(scale);
+            layer.biases[row] = static_cast<float>(biases(r, 0));
+        }
+        return layer;
+    }
+
+    // Sizes the buffers for the widest layer. Does nothing once they are large enough.
+    void prepare(Workspace& workspace) const {
+        size_t activationBytes = 0, valueCount = 0;
+        for (const Layer& layer : layers) {
+            activationBytes = std::max(activationBytes, layer.stride);
+            valueCount = std::max(valueCount, layer.outputs);
+        }
+        if (workspace.activations.size() < activationBytes) {
+            workspace.activations.resize(activationBytes);
+        }
+        if (workspace.values.size() < valueCount) {
+            workspace.values.resize(valueCount);
+        }
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include "layers.hpp"
+#include <eigen3/Eigen/Dense>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Parameter block with compile-time shape. Eigen keeps fixed-size objects inline and refuses ones
+// above EIGEN_STACK_ALLOCATION_LIMIT, so larger blocks fall back to dynamic storage; the products
+// with them still see the fixed-size vectors on the other side.
+template<typename Scalar, int Rows, int Cols>
+using StaticBlock = std::conditional_t<
+        static_cast<size_t>(Rows) * Cols * sizeof(Scalar) <= EIGEN_STACK_ALLOCATION_LIMIT,
+        Eigen::Matrix<Scalar, Rows, Cols>, MatrixX<Scalar>>;
+
+// Inference-only copy of the Input -> Hidden (ReLU) -> Output network with every shape known at
+// compile time. There are no virtual calls and no layer objects: one sample goes through two
+// inlined products, with the hidden bias and ReLU fused into the first one, and all activations
+// live on the stack. The parameters are copied from a trained dynamic layer stack.
+template<typename Scalar, int Input, int Hidden, int Output>
+class StaticMLP {
+public:
+    using InputVector = Eigen::Matrix<Scalar, Input, 1>;
+    using HiddenVector = Eigen::Matrix<Scalar, Hidden, 1>;
+    using OutputVector = Eigen::Matrix<Scalar, Output, 1>;
+
+    static constexpr int hiddenSize = Hidden;
+
+private:
+    StaticBlock<Scalar, Hidden, Input> hiddenWeights = StaticBlock<Scalar, Hidden, Input>::Zero(Hidden, Input);
+    HiddenVector hiddenBiases = HiddenVector::Zero();
+    StaticBlock<Scalar, Output, Hidden> outputWeights = StaticBlock<Scalar, Output, Hidden>::Zero(Output, Hidden);
+    OutputVector outputBiases = OutputVector::Zero();
+
+public:
+    // Copies the parameters of a FullyConnected, ReLU, FullyConnected stack, or of a
+    // FullyConnectedReLU, FullyConnected one, optionally followed by a SoftMax layer, which does not
+    // change the predicted class and is left out.
+    void load(const std::vector<std::shared_ptr<BaseLayer<Scalar>>>& layers) {
+        const bool fused = !layers.empty() && layers[0]->type() == LayerType::FullyConnectedReLU;
+        const size_t outputIndex = fused ? 1 : 2;
+        if (layers.size() <= outputIndex || layers[outputIndex]->type() != LayerType::FullyConnected
+            || (!fused && (layers[0]->type() != LayerType::FullyConnected || layers[1]->type() != LayerType::ReLU))) {
+            throw std::runtime_error("StaticMLP needs a network of one hidden ReLU layer");
+        }
+
+        const std::shared_ptr<const BaseLayer<Scalar>> hiddenLayer = layers[0], outputLayer = layers[outputIndex];
+        std::vector<Eigen::Ref<const MatrixX<Scalar>>> hiddenParameters = hiddenLayer->parameters();
+        std::vector<Eigen::Ref<const MatrixX<Scalar>>> outputParameters = outputLayer->parameters();
+        if (hiddenParameters[0].rows() != Hidden || hiddenParameters[0].cols() != Input
+            || outputParameters[0].rows() != Output || outputParameters[0].cols() != Hidden) {
+            throw std::runtime_error("StaticMLP shape does not match the network");
+        }
+
+        hiddenWeights = hiddenParameters[0];
+        hiddenBiases = hiddenParameters[1];
+        outputWeights = outputParameters[0];
+        outputBiases = outputParameters[1];
+    }
+
+    // Computes the logits of one sample.
+    void forward(const Eigen::Ref<const InputVector>& input, OutputVector& logits) const {
+        // Dense and ReLU in one expression: the hidden activation is written once, already clamped
+        const HiddenVector hidden = (hiddenWeights * input + hiddenBiases).cwiseMax(Scalar(0));
+
+        logits.noalias() = outputWeights * hidden;
+        logits += outputBiases;
+    }
+
+    // Index of the largest logit of one sample.
+    int predict(const Eigen::Ref<const InputVector>& input) const {
+        OutputVector logits;
+        forward(input, logits);
+
+        int prediction;
+        logits.maxCoeff(&prediction);
+        return prediction;
+    }
+};
+
+// Calls function with a StaticMLP if the shape is 784 -> hidden -> 10 for one of the specialized
+// hidden sizes, and returns whether it did. Callers use the dynamic network for every other shape.
+template<typename Scalar, typename Function>
+bool withStaticMLP(int inputSize, int hiddenSize, int outputSize, Function&& function) {
+    if (inputSize != 784 || outputSize != 10) {
+        return false;
+    }
+
+    switch (hiddenSize) {
+        case 64:
+            function(*std::make_unique<StaticMLP<Scalar, 784, 64, 10>>());
+            return true;
+        case 128:
+            function(*std::make_unique<StaticMLP<Scalar, 784, 128, 10>>());
+            return true;
+        case 256:
+            function(*std::make_unique<StaticMLP<Scalar, 784, 256, 10>>());
+            return true;
+        case 500:
+            function(*std::make_unique<StaticMLP<Scalar, 784, 500, 10>>());
+            return true;
+        default:
+            return false;
+    }
+}
@@ -10,6 +10,17 @@
 #include <sstream>
 #include <cassert>
 #include <utility>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <span>
+#include <tuple>
 
 inline size_t flatIdx(const std::vector< size_t >& shape, const std::vector< size_t >& idx)
 {
@@ -69,9 +80,201 @@ ScalarType stringToScalar(const std::string& str)
 template< class T >
 concept Arithmetic = std::is_arithmetic_v< T >;
 
-template< Arithmetic ComponentType >
+// Rank argument of Tensor for tensors whose rank is only known at runtime.
+constexpr size_t DynamicRank = static_cast< size_t >(-1);
+
+// Row-major strides of a shape: the distance in elements between neighbours along every dimension.
+template< typename Shape >
+Shape rowMajorStrides(const Shape& shape)
+{
+    Shape strides = shape;
+    size_t stride = 1;
+    for (size_t i = shape.size(); i > 0; i--)
+    {
+        strides[i - 1] = stride;
+        stride *= shape[i - 1];
+    }
+    return strides;
+}
+
+// Tensor of fixed rank. Shape and strides are std::arrays, so an element access compiles down to
+// Rank multiply-adds and never allocates.
+template< Arithmetic ComponentType, size_t Rank = DynamicRank >
 class Tensor
 {
+public:
+    using Shape = std::array< size_t, Rank >;
+
+    // Constructs a tensor with all extents zero (a single element for rank 0).
+    Tensor();
+
+    // Constructs a tensor of the given shape and fills it with the specified value.
+    explicit Tensor(const Shape& shape, const ComponentType& fillValue = ComponentType(0));
+
+    // Returns the rank of the tensor.
+    [[nodiscard]] static constexpr size_t rank() { return Rank; }
+
+    // Returns the shape of the tensor.
+    [[nodiscard]] const Shape& shape() const;
+
+    // Returns the distance in elements between neighbours along every dimension.
+    [[nodiscard]] const Shape& strides() const;
+
+    // Returns the number of elements of this tensor.
+    [[nodiscard]] size_t numElements() const;
+
+    // Element access function, one index per dimension
+    template< std::integral... Indices > requires (sizeof...(Indices) == Rank)
+    const ComponentType&
+    operator()(Indices... idx) const;
+
+    // Element mutation function, one index per dimension
+    template< std::integral... Indices > requires (sizeof...(Indices) == Rank)
+    ComponentType&
+    operator()(Indices... idx);
+
+    // Element access function
+    const ComponentType&
+    operator()(const Shape& idx) const;
+
+    // Element mutation function
+    ComponentType&
+    operator()(const Shape& idx);
+
+    // Contiguous storage of all elements in row-major order.
+    const ComponentType* data() const;
+
+    ComponentType* data();
+
+    std::span< const ComponentType > elements() const;
+
+    std::span< ComponentType > elements();
+
+private:
+    template< std::integral... Indices >
+    size_t offset(Indices... idx) const;
+
+    Shape shape_;
+    Shape strides_;
+    std::vector< ComponentType > data_;
+};
+
+template< Arithmetic ComponentType, size_t Rank >
+Tensor< ComponentType, Rank >::Tensor()
+    : Tensor(Shape{})
+{
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+Tensor< ComponentType, Rank >::Tensor(const Shape& shape, const ComponentType& fillValue)
+    : shape_(shape), strides_(rowMajorStrides(shape)), data_(numTensorElements({shape.begin(), shape.end()}), fillValue)
+{
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+const typename Tensor< ComponentType, Rank >::Shape&
+Tensor< ComponentType, Rank >::shape() const
+{
+    return shape_;
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+const typename Tensor< ComponentType, Rank >::Shape&
+Tensor< ComponentType, Rank >::strides() const
+{
+    return strides_;
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+size_t
+Tensor< ComponentType, Rank >::numElements() const
+{
+    return data_.size();
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+template< std::integral... Indices >
+size_t
+Tensor< ComponentType, Rank >::offset(Indices... idx) const
+{
+    size_t flat = 0;
+    size_t dim = 0;
+    ((flat += static_cast< size_t >(idx) * strides_[dim++]), ...);
+    return flat;
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+template< std::integral... Indices > requires (sizeof...(Indices) == Rank)
+const ComponentType&
+Tensor< ComponentType, Rank >::operator()(Indices... idx) const
+{
+    return data_[offset(idx...)];
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+template< std::integral... Indices > requires (sizeof...(Indices) == Rank)
+ComponentType&
+Tensor< ComponentType, Rank >::operator()(Indices... idx)
+{
+    return data_[offset(idx...)];
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+const ComponentType&
+Tensor< ComponentType, Rank >::operator()(const Shape& idx) const
+{
+    return std::apply([this](auto... i) -> const ComponentType& { return data_[offset(i...)]; }, idx);
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+ComponentType&
+Tensor< ComponentType, Rank >::operator()(const Shape& idx)
+{
+    return std::apply([this](auto... i) -> ComponentType& { return data_[offset(i...)]; }, idx);
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+const ComponentType*
+Tensor< ComponentType, Rank >::data() const
+{
+    return data_.data();
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+ComponentType*
+Tensor< ComponentType, Rank >::data()
+{
+    return data_.data();
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+std::span< const ComponentType >
+Tensor< ComponentType, Rank >::elements() const
+{
+    return data_;
+}
+
+template< Arithmetic ComponentType, size_t Rank >
+std::span< ComponentType >
+Tensor< ComponentType, Rank >::elements()
+{
+    return data_;
+}
+
+// Returns true if the shapes and all elements of both tensors are equal.
+template< Arithmetic ComponentType, size_t Rank >
+bool operator==(const Tensor< ComponentType, Rank >& a, const Tensor< ComponentType, Rank >& b)
+{
+    return a.shape() == b.shape() && std::ranges::equal(a.elements(), b.elements());
+}
+
+
+// Tensor whose rank is chosen at runtime. Strides are computed once per shape, so indexing is one
+// multiply-add per dimension. Prefer the variadic or std::array indexers, which do not allocate,
+// over the std::vector one.
+template< Arithmetic ComponentType >
+class Tensor< ComponentType, DynamicRank >
+{
 public:
     // Constructs a tensor with rank = 0 and zero-initializes the element.
     Tensor();
@@ -103,7 +306,10 @@ public:
     [[nodiscard]] size_t rank() const;
 
     // Returns the shape of the tensor.
-    [[nodiscard]] std::vector< size_t > shape() const;
+    [[nodiscard]] const std::vector< size_t >& shape() const;
+
+    // Returns the distance in elements between neighbours along every dimension.
+    [[nodiscard]] const std::vector< size_t >& strides() const;
 
     // Returns the number of elements of this tensor.
     [[nodiscard]] size_t numElements() const;
@@ -116,9 +322,41 @@ public:
     ComponentType&
     operator()(const std::vector< size_t >& idx);
 
+    // Element access function, one index per dimension
+    template< std::integral... Indices >
+    const ComponentType&
+    operator()(Indices... idx) const;
+
+    // Element mutation function, one index per dimension
+    template< std::integral... Indices >
+    ComponentType&
+    operator()(Indices... idx);
+
+    // Element access function
+    template< size_t N >
+    const ComponentType&
+    operator()(const std::array< size_t, N >& idx) const;
+
+    // Element mutation function
+    template< size_t N >
+    ComponentType&
+    operator()(const std::array< size_t, N >& idx);
+
+    // Contiguous storage of all elements in row-major order.
+    const ComponentType* data() const;
+
+    ComponentType* data();
+
+    std::span< const ComponentType > elements() const;
+
+    std::span< ComponentType > elements();
+
 private:
+    template< typename Index >
+    size_t offset(const Index& idx) const;
 
     std::vector< size_t > shape_;
+    std::vector< size_t > strides_;
     std::vector< ComponentType > data_;
 
 };
@@ -132,13 +370,13 @@ Tensor< ComponentType >::Tensor()
 
 template< Arithmetic ComponentType >
 Tensor< ComponentType >::Tensor(const std::vector< size_t >& shape)
-    : shape_(shape), data_(numTensorElements(shape), 0)
+    : shape_(shape), strides_(rowMajorStrides(shape)), data_(numTensorElements(shape), 0)
 {
 }
 
 template< Arithmetic ComponentType >
 Tensor< ComponentType >::Tensor(const std::vector< size_t >& shape, const ComponentType& fillValue)
-    : shape_(shape), data_(numTensorElements(shape), fillValue)
+    : shape_(shape), strides_(rowMajorStrides(shape)), data_(numTensorElements(shape), fillValue)
 {
 }
 
@@ -150,7 +388,9 @@ Tensor< ComponentType >::Tensor(const Tensor< ComponentType >& other) = default;
 // Move-constructor.
 template< Arithmetic ComponentType >
 Tensor< ComponentType >::Tensor(Tensor< ComponentType >&& other) noexcept
-    : shape_(std::exchange(other.shape_, std::vector< size_t >())), data_(std::exchange(other.data_, {0}))
+    : shape_(std::exchange(other.shape_, std::vector< size_t >())),
+      strides_(std::exchange(other.strides_, std::vector< size_t >())),
+      data_(std::exchange(other.data_, {0}))
 {
 }
 
@@ -165,6 +405,7 @@ Tensor< ComponentType >& Tensor< ComponentType >::operator=(Tensor< ComponentTyp
 
 {
     shape_ = std::exchange(other.shape_, std::vector< size_t >());
+    strides_ = std::exchange(other.strides_, std::vector< size_t >());
     data_ = std::exchange(other.data_, {0});
     return *this;
 }
@@ -177,167 +418,209 @@ Tensor< ComponentType >::rank() const
 }
 
 template< Arithmetic ComponentType >
-std::vector< size_t >
+const std::vector< size_t >&
 Tensor< ComponentType >::shape() const
 {
     return shape_;
 }
 
+template< Arithmetic ComponentType >
+const std::vector< size_t >&
+Tensor< ComponentType >::strides() const
+{
+    return strides_;
+}
+
 template< Arithmetic ComponentType >
 size_t
 Tensor< ComponentType >::numElements() const
 {
-    return numTensorElements(shape_);
+    return data_.size();
+}
+
+template< Arithmetic ComponentType >
+template< typename Index >
+size_t
+Tensor< ComponentType >::offset(const Index& idx) const
+{
+    assert(idx.size() == rank());
+
+    size_t flat = 0;
+    for (size_t i = 0; i < idx.size(); i++)
+    {
+        flat += idx[i] * strides_[i];
+    }
+    return flat;
 }
 
 template< Arithmetic ComponentType >
 const ComponentType&
 Tensor< ComponentType >::operator()(const std::vector< size_t >& idx) const
 {
-    assert(idx.size() == rank());
-    return data_[flatIdx(shape_, idx)];
+    return data_[offset(idx)];
 }
 
 template< Arithmetic ComponentType >
 ComponentType&
 Tensor< ComponentType >::operator()(const std::vector< size_t >& idx)
 {
-    assert(idx.size() == rank());
-    return data_[flatIdx(shape_, idx)];
+    return data_[offset(idx)];
 }
 
-
-// Returns true if the shapes and all elements of both tensors are equal.
 template< Arithmetic ComponentType >
-bool operator==(const Tensor< ComponentType >& a, const Tensor< ComponentType >& b)
+template< std::integral... Indices >
+const ComponentType&
+Tensor< ComponentType >::operator()(Indices... idx) const
 {
+    return data_[offset(std::array< size_t, sizeof...(Indices) >{static_cast< size_t >(idx)...})];
+}
 
-    if (a.shape() != b.shape())
-    {
-        return false;
-    }
+template< Arithmetic ComponentType >
+template< std::integral... Indices >
+ComponentType&
+Tensor< ComponentType >::operator()(Indices... idx)
+{
+    return data_[offset(std::array< size_t, sizeof...(Indices) >{static_cast< size_t >(idx)...})];
+}
 
-    size_t rank = a.rank();
-    std::vector< size_t > shape = a.shape();
-    size_t numElements = a.numElements();
+template< Arithmetic ComponentType >
+template< size_t N >
+const ComponentType&
+Tensor< ComponentType >::operator()(const std::array< size_t, N >& idx) const
+{
+    return data_[offset(idx)];
+}
 
-    bool equal = true;
+template< Arithmetic ComponentType >
+template< size_t N >
+ComponentType&
+Tensor< ComponentType >::operator()(const std::array< size_t, N >& idx)
+{
+    return data_[offset(idx)];
+}
 
-    if (rank == 0)
-    {
-        std::vector< size_t > idx(0);
-        return a(idx) == b(idx);
-    }
-    else if (rank == 1)
-    {
-        for (size_t i = 0; i < shape[0]; i++)
-        {
-            std::vector< size_t > idx(1);
-            idx[0] = i;
-            equal &= a(idx) == b(idx);
-        }
-    }
-    else
-    {
-        size_t cnt = 0;
-        std::vector< size_t > idx(rank, 0);
+template< Arithmetic ComponentType >
+const ComponentType*
+Tensor< ComponentType >::data() const
+{
+    return data_.data();
+}
 
-        while (cnt < numElements)
-        {
-            for (size_t i = 0; i < shape[rank - 1]; i++)
-            {
-                equal &= a(idx) == b(idx);
-                idx[rank - 1]++;
-            }
+template< Arithmetic ComponentType >
+ComponentType*
+Tensor< ComponentType >::data()
+{
+    return data_.data();
+}
 
-            idx[rank - 1]++;
+template< Arithmetic ComponentType >
+std::span< const ComponentType >
+Tensor< ComponentType >::elements() const
+{
+    return data_;
+}
 
-            for (size_t i = rank - 1; i > 0; i--)
-            {
-                if (idx[i] >= shape[i])
-                {
-                    idx[i] = 0;
-                    idx[i - 1]++;
-                }
-            }
+template< Arithmetic ComponentType >
+std::span< ComponentType >
+Tensor< ComponentType >::elements()
+{
+    return data_;
+}
 
-            cnt += shape[rank - 1];
-        }
-    }
 
-    return equal;
+// Returns true if the shapes and all elements of both tensors are equal.
+// Elements are stored contiguously in row-major order, so they are compared in one pass.
+template< Arithmetic ComponentType >
+bool operator==(const Tensor< ComponentType >& a, const Tensor< ComponentType >& b)
+{
+    return a.shape() == b.shape() && std::ranges::equal(a.elements(), b.elements());
 }
 
 // Pretty-prints the tensor to stdout.
 // This is not necessary (and not covered by the tests) but nice to have, also for debugging (and for exercise of course...).
+// Every line holds one row along the last dimension, prefixed by the indices of the other dimensions.
 template< Arithmetic ComponentType >
 std::ostream&
 operator<<(std::ostream& out, const Tensor< ComponentType >& tensor)
 {
+    const ComponentType* data = tensor.data();
 
     if (tensor.rank() == 0)
     {
-        std::vector< size_t > idx(0);
-        out << "() [" << tensor(idx) << "]\n";
+        out << "() [" << data[0] << "]\n";
     }
     else if (tensor.rank() == 1)
     {
         out << "(:) [";
         for (size_t i = 0; i < tensor.shape()[0] - 1; i++)
         {
-            std::vector< size_t > idx(1);
-            idx[0] = i;
-            out << tensor(idx) << " ";
+            out << data[i] << " ";
         }
-        std::vector< size_t > idx(1);
-        idx[0] = tensor.shape()[0] - 1;
-        out << tensor(idx) << "]\n";
+        out << data[tensor.shape()[0] - 1] << "]\n";
     }
     else
     {
-        size_t cnt = 0;
-        std::vector< size_t > idx(tensor.rank(), 0);
+        const size_t rowLength = tensor.shape()[tensor.rank() - 1];
 
-        while (cnt < tensor.numElements())
+        for (size_t first = 0; first < tensor.numElements(); first += rowLength)
         {
             out << "(";
             for (size_t i = 0; i < tensor.rank() - 1; i++)
             {
-                out << idx[i] << ", ";
+                out << first / tensor.strides()[i] % tensor.shape()[i] << ", ";
             }
             out << ":) [";
-            for (size_t i = 0; i < tensor.shape()[tensor.rank() - 1] - 1; i++)
+            for (size_t i = 0; i < rowLength - 1; i++)
             {
-                out << tensor(idx) << " ";
-                idx[tensor.rank() - 1]++;
+                out << data[first + i] << " ";
             }
-
-            out << tensor(idx) << "]\n";
-            idx[tensor.rank() - 1]++;
-
-            for (size_t i = tensor.rank() - 1; i > 0; i--)
-            {
-                if (idx[i] >= tensor.shape()[i])
-                {
-                    idx[i] = 0;
-                    idx[i - 1]++;
-                }
-            }
-
-            cnt += tensor.shape()[tensor.rank() - 1];
+            out << data[first + rowLength - 1] << "]\n";
         }
     }
 
     return out;
 }
 
-// Reads a tensor from file.
+// On-disk formats of a tensor. Text is the line-based ASCII format: rank, one line per extent of
+// the shape and one line per element in row-major order. Binary starts with TENSOR_FILE_MAGIC,
+// followed by a TensorFileHeader, the shape as uint64 values and the raw elements in row-major order.
+enum class TensorFileFormat
+{
+    Text,
+    Binary
+};
+
+constexpr uint32_t TENSOR_FILE_MAGIC = 0x524E5354; // "TSNR" read as little-endian bytes
+
+struct TensorFileHeader
+{
+    uint32_t magic = TENSOR_FILE_MAGIC;
+    uint32_t elementKind = 0; // 0: signed integer, 1: unsigned integer, 2: floating point
+    uint32_t elementSize = 0;
+    uint32_t rank = 0;
+};
+
 template< Arithmetic ComponentType >
-Tensor< ComponentType > readTensorFromFile(const std::string& filename)
+constexpr uint32_t tensorElementKind()
 {
+    if constexpr (std::is_floating_point_v< ComponentType >)
+    {
+        return 2;
+    }
+    else if constexpr (std::is_signed_v< ComponentType >)
+    {
+        return 0;
+    }
+    else
+    {
+        return 1;
+    }
+}
 
-    std::ifstream file;
-    file.open(filename);
+// Reads a whole file into memory with one read.
+inline std::string readFileContents(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
 
     if (!file.is_open())
     {
@@ -345,91 +628,194 @@ Tensor< ComponentType > readTensorFromFile(const std::string& filename)
         std::exit(1);
     }
 
-    std::string line;
-    std::getline(file, line);
+    std::string contents(static_cast< size_t >(file.tellg()), '\0');
+    file.seekg(0, std::ios::beg);
+    file.read(contents.data(), static_cast< std::streamsize >(contents.size()));
 
-    auto rank = stringToScalar< size_t >(line);
+    return contents;
+}
 
-    std::vector< size_t > shape(rank);
-    for (size_t i = 0; i < rank; i++)
+// Parses the next whitespace separated number of a text tensor file and advances pos past it.
+template< Arithmetic ValueType >
+ValueType parseTensorValue(const char*& pos, const char* end)
+{
+    while (pos != end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
     {
-        std::getline(file, line);
-        shape[i] = stringToScalar< size_t >(line);
+        pos++;
     }
 
-    Tensor< ComponentType > tensor(shape);
-
-    if (rank == 0)
+    // from_chars does not parse bool, and text files store it as 0 or 1
+    using ParsedType = std::conditional_t< std::is_same_v< ValueType, bool >, int, ValueType >;
+    ParsedType value{};
+    auto [next, error] = std::from_chars(pos, end, value);
+    if (error != std::errc())
     {
-        std::getline(file, line);
-        tensor(shape) = stringToScalar< ComponentType >(line);
+        std::cerr << "Could not parse tensor file." << std::endl;
+        std::exit(1);
     }
-    else
+
+    pos = next;
+    return static_cast< ValueType >(value);
+}
+
+template< Arithmetic ComponentType >
+Tensor< ComponentType > readTensorFromBinary(const std::string& contents)
+{
+    TensorFileHeader header;
+    std::memcpy(&header, contents.data(), sizeof(header));
+
+    if (header.elementKind != tensorElementKind< ComponentType >() || header.elementSize != sizeof(ComponentType))
     {
-        std::vector< size_t > idx(shape.size(), 0);
-        size_t cnt = 0;
-        while (cnt < tensor.numElements())
-        {
-            std::getline(file, line);
-            tensor(idx) = stringToScalar< ComponentType >(line);
+        std::cerr << "Tensor file does not match the element type." << std::endl;
+        std::exit(1);
+    }
 
-            idx[rank - 1]++;
-            for (size_t i = rank - 1; i > 0; i--)
-            {
-                if (idx[i] >= shape[i])
-                {
-                    idx[i] = 0;
-                    idx[i - 1]++;
-                }
-            }
+    // The shape table and the data must fit into the file before anything is sized from them, so a
+    // corrupt header cannot cause a huge allocation
+    const size_t available = contents.size() - sizeof(header);
+    if (header.rank > available / sizeof(uint64_t))
+    {
+        std::cerr << "Truncated tensor file." << std::endl;
+        std::exit(1);
+    }
+    const size_t shapeBytes = header.rank * sizeof(uint64_t);
 
-            cnt++;
+    std::vector< size_t > shape(header.rank);
+    size_t elementCount = 1;
+    for (size_t i = 0; i < shape.size(); i++)
+    {
+        uint64_t extent;
+        std::memcpy(&extent, contents.data() + sizeof(header) + i * sizeof(uint64_t), sizeof(extent));
+        shape[i] = static_cast< size_t >(extent);
+        if (shape[i] != 0 && elementCount > std::numeric_limits< size_t >::max() / shape[i])
+        {
+            std::cerr << "Tensor file shape is too large." << std::endl;
+            std::exit(1);
         }
+        elementCount *= shape[i];
+    }
+
+    if (elementCount > (available - shapeBytes) / sizeof(ComponentType)
+        || available - shapeBytes != elementCount * sizeof(ComponentType))
+    {
+        std::cerr << "Truncated tensor file." << std::endl;
+        std::exit(1);
     }
+    const size_t dataBytes = elementCount * sizeof(ComponentType);
+
+    Tensor< ComponentType > tensor(shape);
+    std::memcpy(tensor.data(), contents.data() + sizeof(header) + shapeBytes, dataBytes);
 
-    file.close();
     return tensor;
 }
 
-// Writes a tensor to file.
+// Reads a tensor from file. The format is detected from the magic number of binary files.
 template< Arithmetic ComponentType >
-void writeTensorToFile(const Tensor< ComponentType >& tensor, const std::string& filename)
+Tensor< ComponentType > readTensorFromFile(const std::string& filename)
 {
+    std::string contents = readFileContents(filename);
+
+    uint32_t magic = 0;
+    if (contents.size() >= sizeof(TensorFileHeader))
+    {
+        std::memcpy(&magic, contents.data(), sizeof(magic));
+    }
+    if (magic == TENSOR_FILE_MAGIC)
+    {
+        return readTensorFromBinary< ComponentType >(contents);
+    }
 
-    std::ofstream file;
-    file.open(filename);
+    const char* pos = contents.data();
+    const char* end = pos + contents.size();
 
-    file << tensor.rank() << "\n";
-    for (auto d : tensor.shape())
+    auto rank = parseTensorValue< size_t >(pos, end);
+
+    std::vector< size_t > shape(rank);
+    for (size_t i = 0; i < rank; i++)
     {
-        file << d << "\n";
+        shape[i] = parseTensorValue< size_t >(pos, end);
     }
 
-    if (tensor.rank() == 0)
+    // Elements are stored in row-major order, the same order as the tensor's storage
+    Tensor< ComponentType > tensor(shape);
+    ComponentType* data = tensor.data();
+    for (size_t i = 0; i < tensor.numElements(); i++)
+    {
+        data[i] = parseTensorValue< ComponentType >(pos, end);
+    }
+
+    return tensor;
+}
+
+// Appends a value to a text tensor file buffer. Floating point values are written with six
+// significant digits in the shortest form, matching the default formatting of std::ostream.
+template< Arithmetic ValueType >
+void appendTensorValue(std::string& buffer, ValueType value)
+{
+    char digits[64];
+    std::to_chars_result result;
+    if constexpr (std::is_floating_point_v< ValueType >)
+    {
+        result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+    }
+    else if constexpr (std::is_same_v< ValueType, bool >)
     {
-        file << tensor({}) << "\n";
+        result = std::to_chars(digits, digits + sizeof(digits), static_cast< int >(value));
     }
     else
     {
-        std::vector< size_t > idx(tensor.shape().size(), 0);
-        size_t cnt = 0;
-        while (cnt < tensor.numElements())
+        result = std::to_chars(digits, digits + sizeof(digits), value);
+    }
+    buffer.append(digits, result.ptr);
+    buffer += '\n';
+}
+
+// Writes a tensor to file, formatted into one buffer and written with a single write.
+template< Arithmetic ComponentType >
+void writeTensorToFile(const Tensor< ComponentType >& tensor, const std::string& filename,
+                       TensorFileFormat format = TensorFileFormat::Text)
+{
+    std::string buffer;
+
+    if (format == TensorFileFormat::Binary)
+    {
+        TensorFileHeader header;
+        header.elementKind = tensorElementKind< ComponentType >();
+        header.elementSize = sizeof(ComponentType);
+        header.rank = static_cast< uint32_t >(tensor.rank());
+
+        const size_t dataBytes = tensor.numElements() * sizeof(ComponentType);
+        buffer.resize(sizeof(header) + tensor.rank() * sizeof(uint64_t) + dataBytes);
+
+        char* pos = buffer.data();
+        std::memcpy(pos, &header, sizeof(header));
+        pos += sizeof(header);
+        for (auto d : tensor.shape())
         {
-            file << tensor(idx) << "\n";
+            uint64_t extent = d;
+            std::memcpy(pos, &extent, sizeof(extent));
+            pos += sizeof(extent);
+        }
+        std::memcpy(pos, tensor.data(), dataBytes);
+    }
+    else
+    {
+        // Rough upper bound of a formatted line, so the buffer grows at most a few times
+        buffer.reserve((tensor.rank() + 1) * 21 + tensor.numElements() * 14);
 
-            idx[tensor.rank() - 1]++;
-            for (size_t i = tensor.rank() - 1; i > 0; i--)
-            {
-                if (idx[i] >= tensor.shape()[i])
-                {
-                    idx[i] = 0;
-                    idx[i - 1]++;
-                }
-            }
+        appendTensorValue(buffer, tensor.rank());
+        for (auto d : tensor.shape())
+        {
+            appendTensorValue(buffer, d);
+        }
 
-            cnt++;
+        const ComponentType* data = tensor.data();
+        for (size_t i = 0; i < tensor.numElements(); i++)
+        {
+            appendTensorValue(buffer, data[i]);
         }
     }
 
-    file.close();
+    std::ofstream file(filename, std::ios::binary);
+    file.write(buffer.data(), static_cast< std::streamsize >(buffer.size()));
 }
@@ -1,88 +1,331 @@
 #include "nn.hpp"
-#include "data_loader/image_io.hpp"
-#include "data_loader/label_io.hpp"
+#include "data_loader/dataset.hpp"
 #include "helpers.hpp"
+#include "prediction_server.hpp"
 
-#define INPUT_SIZE 784
+#define INPUT_SIZE IMAGE_SIZE
 #define OUTPUT_SIZE 10
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "expected config as one and only parameter" << std::endl;
+// Loads the data, then trains and tests a network with parameters and activations of type Scalar.
+template<typename Scalar>
+int run(std::map <std::string, std::string>& config, int hiddenSize, int epochs, int batchSize, double learningRate) {
+    std::string trainingImagePath = config["rel_path_train_images"];
+    std::string trainingLabelPath = config["rel_path_train_labels"];
+
+    std::string testingImagePath = config["rel_path_test_images"];
+    std::string testingLabelPath = config["rel_path_test_labels"];
+
+    std::string predictionLogFileName = config["rel_path_log_file"];
+
+    // "profile = true" prints a time breakdown of the instrumented hot paths after every epoch, and
+    // "trace_file" also records every timed call and writes them as Chrome trace JSON at the end.
+    // Both need a build with the NN_PROFILING CMake option.
+    std::string traceFile = config.contains("trace_file") ? config["trace_file"] : "";
+    if ((config.contains("profile") && config["profile"] == "true") || !traceFile.empty()) {
+#ifdef NN_PROFILING
+        Profiler::instance().enable(!traceFile.empty());
+        NN_PROFILE_THREAD("main");
+#else
+        std::cerr << "profile and trace_file need a build with -DNN_PROFILING=ON, ignoring them" << std::endl;
+        traceFile.clear();
+#endif
+    }
+
+    // "bulk" reads every IDX file once into memory, "mmap" maps the files and converts per batch
+    std::string dataBackend = config.contains("data_backend") ? config["data_backend"] : "bulk";
+
+    // "serve = <socket path>" or "serve = stdin" answers prediction requests with the parameters of
+    // load_checkpoint instead of training, so no dataset is loaded
+    const bool serving = config.contains("serve");
+
+    std::shared_ptr<const Dataset<Scalar>> trainingSet, testingSet;
+    if (serving) {
+        if (!config.contains("load_checkpoint")) {
+            std::cerr << "serve needs load_checkpoint" << std::endl;
+            return -1;
+        }
+    } else if (dataBackend == "mmap") {
+        auto mapDataset = [](const std::string& name, const std::string& imagePath, const std::string& labelPath) {
+            auto dataset = std::make_shared<MappedDataset<Scalar>>(imagePath, labelPath);
+            std::cout << "Mapped " << dataset->size() << " " << name << " samples (" << dataset->mappedBytes() / 1e6
+                      << " MB)" << std::endl;
+            return dataset;
+        };
+        trainingSet = mapDataset("training", trainingImagePath, trainingLabelPath);
+        testingSet = mapDataset("testing", testingImagePath, testingLabelPath);
+    } else if (dataBackend == "bulk") {
+        // Each IDX file is opened and read exactly once
+        auto loadDataset = [](const std::string& name, const std::string& imagePath, const std::string& labelPath) {
+            IdxDataset<Scalar> dataset = loadIdxDataset<Scalar>(imagePath, labelPath);
+            std::cout << "Loaded " << dataset.size() << " " << name << " samples (" << dataset.bytes_read / 1e6
+                      << " MB) in " << dataset.load_seconds << " s, " << dataset.throughputMBps() << " MB/s" << std::endl;
+            return std::make_shared<InMemoryDataset<Scalar>>(std::move(dataset));
+        };
+        trainingSet = loadDataset("training", trainingImagePath, trainingLabelPath);
+        testingSet = loadDataset("testing", testingImagePath, testingLabelPath);
+    } else {
+        std::cerr << "unknown data_backend: " << dataBackend << std::endl;
         return -1;
     }
 
-    std::ifstream configfile(argv[1]);
-    if (!configfile.is_open()) {
-        std::cerr << "could not open configfile" << std::endl;
+    if (!serving) {
+        std::cout << "Data Loaded" << std::endl;
+    }
+
+    // Initialize neural network with config parameters
+    NeuralNetwork<Scalar> neuralNetwork(static_cast<Scalar>(learningRate), trainingSet, testingSet);
+
+    // "fused" computes softmax and cross-entropy in one stage, "separate" uses a SoftMax layer
+    std::string outputStageName = config.contains("output_stage") ? config["output_stage"] : "fused";
+    OutputStage outputStage;
+    if (outputStageName == "fused") {
+        outputStage = OutputStage::FusedSoftMaxCrossEntropy;
+    } else if (outputStageName == "separate") {
+        outputStage = OutputStage::SoftMaxThenCrossEntropy;
+    } else {
+        std::cerr << "unknown output_stage: " << outputStageName << std::endl;
         return -1;
     }
 
-    std::map <std::string, std::string> config = parseConfigfile(configfile);
+    // "eigen" runs the dense layers on Eigen's GEMM, "native" on the kernels of matvec.hpp
+    std::string backendName = config.contains("compute_backend") ? config["compute_backend"] : "eigen";
+    ComputeBackend computeBackend;
+    if (!parseComputeBackend(backendName, computeBackend)) {
+        std::cerr << "unknown compute_backend: " << backendName << std::endl;
+        return -1;
+    }
+    if (computeBackend == ComputeBackend::Native) {
+        std::cout << "Native kernels use " << simdLevelName(activeSimdLevel()) << std::endl;
+    }
 
-    // load hyperparameters and paths from config file
-    int hiddenSize = std::stoi(config["hidden_size"]);
-    int epochs = std::stoi(config["num_epochs"]);
-    int batchSize = std::stoi(config["batch_size"]);
-    double learningRate = std::stod(config["learning_rate"]);
+    // "true" fuses the hidden ReLU into its dense layer
+    bool fuseReLU = config.contains("fuse_relu") && config["fuse_relu"] == "true";
 
-    std::string trainingImagePath = config["rel_path_train_images"];
-    std::string trainingLabelPath = config["rel_path_train_labels"];
+    // Setup layers based on sizes
+    neuralNetwork.setupLayers(INPUT_SIZE, hiddenSize, OUTPUT_SIZE, outputStage, computeBackend, fuseReLU);
 
-    std::string testingImagePath = config["rel_path_test_images"];
-    std::string testingLabelPath = config["rel_path_test_labels"];
+    // Optionally resume from the parameters of an earlier run
+    if (config.contains("load_checkpoint")) {
+        auto loadStart = std::chrono::steady_clock::now();
+        neuralNetwork.loadCheckpoint(config["load_checkpoint"]);
+        std::cout << "Loaded checkpoint " << config["load_checkpoint"] << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count()
+                  << " ms" << std::endl;
+    }
 
-    std::string predictionLogFileName = config["rel_path_log_file"];
+    // Group concurrent requests into batches of up to serve_max_batch images, waiting at most
+    // serve_max_delay_us for a batch to fill, and report latencies every serve_report_seconds
+    if (serving) {
+        ServerSettings serverSettings;
+        serverSettings.endpoint = config["serve"];
+        serverSettings.maxBatch = config.contains("serve_max_batch") ? std::stoul(config["serve_max_batch"]) : serverSettings.maxBatch;
+        serverSettings.maxDelay = config.contains("serve_max_delay_us") ? std::chrono::microseconds(std::stol(config["serve_max_delay_us"])) : serverSettings.maxDelay;
+        serverSettings.reportInterval = config.contains("serve_report_seconds") ? std::chrono::duration<double>(std::stod(config["serve_report_seconds"])) : serverSettings.reportInterval;
+
+        PredictionServer<Scalar> server(neuralNetwork, INPUT_SIZE, serverSettings);
+        server.run();
 
-    // open log file and create the testing log header
-    std::ofstream file(predictionLogFileName);
-    if (!file) {
-        std::cerr << "Unable to open file for writing.\n";
+        if (!traceFile.empty()) {
+            size_t events = Profiler::instance().writeTrace(traceFile);
+            std::cout << "Wrote " << events << " trace events to " << traceFile << std::endl;
+        }
+        return 0;
+    }
+
+    // Number of threads every batch is split across
+    neuralNetwork.setThreadCount(config.contains("num_threads") ? std::stoul(config["num_threads"]) : 1);
+
+    // "sync" splits every batch across the threads, "hogwild" trains lock-free on one shard per thread
+    std::string trainer = config.contains("trainer") ? config["trainer"] : "sync";
+    if (trainer == "hogwild") {
+        neuralNetwork.setTrainingMode(TrainingMode::Hogwild);
+    } else if (trainer != "sync") {
+        std::cerr << "unknown trainer: " << trainer << std::endl;
         return -1;
     }
-    file << "Current batch: 0\n";
-    file.close();
 
-    std::cout << "Config Loaded" << std::endl;
+    // "sgd", "momentum", "adam" or "adamw", with the hyperparameters of the chosen optimizer
+    OptimizerSettings optimizerSettings;
+    std::string optimizer = config.contains("optimizer") ? config["optimizer"] : "sgd";
+    if (!parseOptimizerType(optimizer, optimizerSettings.type)) {
+        std::cerr << "unknown optimizer: " << optimizer << std::endl;
+        return -1;
+    }
+    optimizerSettings.momentum = config.contains("momentum") ? std::stod(config["momentum"]) : optimizerSettings.momentum;
+    optimizerSettings.beta1 = config.contains("beta1") ? std::stod(config["beta1"]) : optimizerSettings.beta1;
+    optimizerSettings.beta2 = config.contains("beta2") ? std::stod(config["beta2"]) : optimizerSettings.beta2;
+    optimizerSettings.epsilon = config.contains("epsilon") ? std::stod(config["epsilon"]) : optimizerSettings.epsilon;
+    optimizerSettings.weightDecay = config.contains("weight_decay") ? std::stod(config["weight_decay"]) : optimizerSettings.weightDecay;
 
-    size_t trainingItemCount = getItemCount(trainingLabelPath);
-    size_t testingItemCount = getItemCount(testingLabelPath);
+    // Number of batches whose gradients are averaged into one update
+    optimizerSettings.accumulationSteps = config.contains("gradient_accumulation") ? std::stoul(config["gradient_accumulation"]) : 1;
+    if (optimizerSettings.accumulationSteps > 1 && trainer == "hogwild") {
+        std::cerr << "gradient_accumulation is not supported by the hogwild trainer" << std::endl;
+        return -1;
+    }
+    neuralNetwork.setOptimizer(optimizerSettings);
 
-    std::vector<std::vector<double>> trainingImageData = std::vector<std::vector<double>>();
-    std::vector<std::vector<double>> trainingLabelData = std::vector<std::vector<double>>();
+    // Both opt-in: "shuffle = true" visits the training samples in a fresh random order every epoch,
+    // "prefetch = true" gathers the batches on a background thread. Without them training runs in
+    // dataset order on the calling thread
+    bool prefetch = config.contains("prefetch") && config["prefetch"] == "true";
+    if (prefetch && trainer == "hogwild") {
+        std::cerr << "prefetch is not supported by the hogwild trainer" << std::endl;
+        return -1;
+    }
 
-    std::vector<std::vector<double>> testingImageData = std::vector<std::vector<double>>();
-    std::vector<std::vector<double>> testingLabelData = std::vector<std::vector<double>>();
+    // Fraction of the training samples held out for validation after every epoch
+    if (config.contains("validation_split")) {
+        neuralNetwork.setValidationSplit(std::stod(config["validation_split"]));
+    }
 
-    for(int i = 0; i < trainingItemCount; i++) {
-        IOimage<double> ioimage(trainingImagePath, i);
-        IOlabel<double> iolabel(trainingLabelPath, i);
-        trainingImageData.push_back(ioimage.extractImageAndNormaliseImage());
-        trainingLabelData.push_back(iolabel.extractLabel());
+    // "constant", "step", "cosine" or "plateau", optionally with a linear warmup
+    ScheduleSettings scheduleSettings;
+    std::string schedule = config.contains("lr_schedule") ? config["lr_schedule"] : "constant";
+    if (!parseScheduleType(schedule, scheduleSettings.type)) {
+        std::cerr << "unknown lr_schedule: " << schedule << std::endl;
+        return -1;
     }
+    scheduleSettings.warmupEpochs = config.contains("lr_warmup_epochs") ? std::stod(config["lr_warmup_epochs"]) : scheduleSettings.warmupEpochs;
+    scheduleSettings.stepEpochs = config.contains("lr_step_epochs") ? std::stoul(config["lr_step_epochs"]) : scheduleSettings.stepEpochs;
+    scheduleSettings.gamma = config.contains("lr_gamma") ? std::stod(config["lr_gamma"]) : scheduleSettings.gamma;
+    scheduleSettings.minLearningRate = config.contains("lr_min") ? std::stod(config["lr_min"]) : scheduleSettings.minLearningRate;
+    scheduleSettings.plateauPatience = config.contains("lr_plateau_patience") ? std::stoul(config["lr_plateau_patience"]) : scheduleSettings.plateauPatience;
+    neuralNetwork.setLearningRateSchedule(scheduleSettings);
+
+    // The split above fixes the training samples, so the order is set up after it
+    neuralNetwork.setDataPipeline(config.contains("shuffle") && config["shuffle"] == "true", prefetch,
+                                  config.contains("shuffle_seed") ? std::stoull(config["shuffle_seed"]) : 5489);
 
-   for (int i = 0; i < testingItemCount; i++) {
-        IOimage<double> ioimage(testingImagePath, i);
-        IOlabel<double> iolabel(testingLabelPath, i);
-        testingImageData.push_back(ioimage.extractImageAndNormaliseImage());
-        testingLabelData.push_back(iolabel.extractLabel());
+    // Stop after this many epochs without a better validation accuracy
+    if (config.contains("early_stopping_patience")) {
+        if (!config.contains("validation_split")) {
+            std::cerr << "early_stopping_patience needs a validation_split" << std::endl;
+            return -1;
+        }
+        neuralNetwork.setEarlyStoppingPatience(std::stoul(config["early_stopping_patience"]));
     }
 
-    std::cout << "Data Loaded" << std::endl;
+    // "true" formats the prediction log on the evaluating thread and writes it on a second one
+    neuralNetwork.setBackgroundLogging(config.contains("background_log") && config["background_log"] == "true");
 
-    // Initialize neural network with config parameters
-    NeuralNetwork neuralNetwork(learningRate, trainingImageData, trainingLabelData, testingImageData, testingLabelData);
+    // "true" reports the test accuracy after every epoch
+    neuralNetwork.setEvaluateEveryEpoch(config.contains("evaluate_every_epoch") && config["evaluate_every_epoch"] == "true");
 
-    // Setup layers based on sizes
-    neuralNetwork.setupLayers(INPUT_SIZE, hiddenSize, OUTPUT_SIZE);
+    // Optionally compare both trainers on a short run
+    if (config.contains("compare_trainers") && config["compare_trainers"] == "true") {
+        neuralNetwork.compareTrainingModes(batchSize, 10000);
+    }
+
+    // Optionally compare training throughput across batch sizes and thread counts before the real run
+    if (config.contains("throughput_sweep") || config.contains("thread_sweep")) {
+        std::vector<size_t> batchSizes = {static_cast<size_t>(batchSize)};
+        std::vector<size_t> threadCounts = {neuralNetwork.getThreadCount()};
+        if (config.contains("throughput_sweep")) {
+            batchSizes = parseSizeList(config["throughput_sweep"]);
+        }
+        if (config.contains("thread_sweep")) {
+            threadCounts = parseSizeList(config["thread_sweep"]);
+        }
+        neuralNetwork.benchmarkThroughput(batchSizes, threadCounts, 10000);
+    }
 
     // Train the network
-    neuralNetwork.train(epochs);
+    neuralNetwork.train(epochs, batchSize);
 
     std::cout << "Training Complete" << std::endl;
 
+    // Optionally persist the trained parameters
+    if (config.contains("save_checkpoint")) {
+        auto saveStart = std::chrono::steady_clock::now();
+        size_t bytes = neuralNetwork.saveCheckpoint(config["save_checkpoint"]);
+        std::cout << "Saved checkpoint " << config["save_checkpoint"] << " (" << bytes / 1e6 << " MB) in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - saveStart).count()
+                  << " ms" << std::endl;
+    }
+
+    // Optionally compare single-image inference latency of the dynamic and the static network
+    if (config.contains("latency_benchmark")) {
+        neuralNetwork.benchmarkInferenceLatency(std::stoul(config["latency_benchmark"]));
+    }
+
+    // Optionally compare the trained network with its int8 quantization on the test set
+    if (config.contains("quantize") && config["quantize"] == "true") {
+        neuralNetwork.compareQuantized();
+    }
+
     // Test the network
     neuralNetwork.test(predictionLogFileName);
 
+    if (!traceFile.empty()) {
+        size_t events = Profiler::instance().writeTrace(traceFile);
+        std::cout << "Wrote " << events << " trace events to " << traceFile << std::endl;
+    }
+
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "expected config as one and only parameter" << std::endl;
+        return -1;
+    }
+
+    std::ifstream configfile(argv[1]);
+    if (!configfile.is_open()) {
+        std::cerr << "could not open configfile" << std::endl;
+        return -1;
+    }
+
+    std::map <std::string, std::string> config = parseConfigfile(configfile);
+
+    // A prediction service ("serve") neither trains nor tests, so it only needs the network shape
+    const bool serving = config.contains("serve");
+    std::vector<std::string> requiredKeys = {"hidden_size"};
+    if (!serving) {
+        requiredKeys.insert(requiredKeys.end(), {"num_epochs", "batch_size", "learning_rate"});
+    }
+    for (const std::string& key : requiredKeys) {
+        if (!config.contains(key)) {
+            std::cerr << "missing config key: " << key << std::endl;
+            return -1;
+        }
+    }
+
+    // load hyperparameters and paths from config file
+    int hiddenSize = std::stoi(config["hidden_size"]);
+    int epochs = serving ? 0 : std::stoi(config["num_epochs"]);
+    int batchSize = serving ? 1 : std::stoi(config["batch_size"]);
+    double learningRate = serving ? 0.0 : std::stod(config["learning_rate"]);
+
+    if (batchSize <= 0) {
+        std::cerr << "batch_size must be positive" << std::endl;
+        return -1;
+    }
+
+    if (!serving) {
+        std::string predictionLogFileName = config["rel_path_log_file"];
+
+        // open log file and create the testing log header
+        std::ofstream file(predictionLogFileName);
+        if (!file) {
+            std::cerr << "Unable to open file for writing.\n";
+            return -1;
+        }
+        file << "Current batch: 0\n";
+        file.close();
+    }
+
+    std::cout << "Config Loaded" << std::endl;
+
+    // "float" halves the memory traffic of weights and activations, "double" is the reference
+    std::string precision = config.contains("precision") ? config["precision"] : "double";
+    if (precision == "float") {
+        return run<float>(config, hiddenSize, epochs, batchSize, learningRate);
+    } else if (precision == "double") {
+        return run<double>(config, hiddenSize, epochs, batchSize, learningRate);
+    }
+
+    std::cerr << "unknown precision: " << precision << std::endl;
+    return -1;
+}